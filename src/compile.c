@@ -0,0 +1,1093 @@
+/*
+ * This file is part of muforth: https://muforth.nimblemachines.com/
+ *
+ * Copyright (c) 2002-2021 David Frech. (Read the LICENSE for details.)
+ */
+
+/* colon compiler: literals, compile, constant folding, and inlining */
+
+#include "muforth.h"
+#include <stdlib.h>
+#include <ctype.h>
+
+/*
+ * Host code is full of "manual" constant folding: [ 1 cells #] and the
+ * like. Without it, the colon compiler compiles a literal and then the
+ * word that operates on it, and the work is done at runtime, every time.
+ *
+ * Instead, literal and compile, - which the colon compiler's token
+ * consumer uses for everything it compiles - cooperate. literal remembers
+ * the last few literals it compiled. As long as these are still "pending"
+ * - sitting at the end of the code, with nothing compiled after them - and
+ * compile, is asked to compile a "pure" word that consumes them, we take
+ * the literals back, execute the word at compile time, and compile its
+ * results as literals instead.
+ *
+ * A word is pure if it only computes values from its inputs: it has no
+ * side effects, doesn't touch memory, and consumes and produces a fixed
+ * number of stack items. We know which of the primitives are pure (see
+ * prims[] below). We work out for ourselves which colon words are pure by
+ * following along as they are compiled.
+ *
+ * Taking literals back must never remove code that something else might
+ * jump to. Every branch destination is found by asking for  here , so
+ * calling  here  forgets all pending literals.
+ *
+ * compile, also inlines short colon words: rather than compiling a call,
+ * it compiles - one at a time, so they fold too - the words of the body.
+ *
+ * Neither is safe everywhere. Some words read the cell that follows them -
+ * (lit), the branches, and compile - and some read or change the return
+ * stack frame of the word they are compiled into, often to find data
+ * compiled after them. Whatever follows one of these has to be compiled
+ * exactly as written.
+ *
+ * Following along also tells us the stack effect of most colon words, so
+ * we can check it against the stack comment that starts the definition.
+ */
+
+static int folding = 1;
+static int inlining = 1;
+
+/* +fold  -- fold constant expressions at compile time -- DEFAULT */
+/* -fold  -- compile exactly what was written */
+void mu_plus_fold()   { folding = 1; }
+void mu_minus_fold()  { folding = 0; }
+
+/* +inline  -- copy short colon words into their callers -- DEFAULT */
+/* -inline  -- always compile a call */
+void mu_plus_inline()   { inlining = 1; }
+void mu_minus_inline()  { inlining = 0; }
+
+/*
+ * Effects
+ *
+ * For each primitive we care about we record how many cells it consumes
+ * and produces on the data stack and on the return stack. A word that
+ * reads return stack cells without popping them "consumes" and then
+ * "produces" them.
+ *
+ * The data stack effect is only meaningful if the word is PURE or KNOWN.
+ * For a branch, it is the effect when the branch isn't taken; taken is
+ * the effect when it is.
+ *
+ * Moving cells between the data and return stacks in a balanced way - like
+ * rot does - doesn't stop a colon word from being pure.
+ *
+ * The primitives don't carry machine-readable stack comments, so this
+ * table is kept by hand. Any word that isn't here has an unknown effect,
+ * and so does every word that calls it.
+ */
+#define PURE    1       /* computes values from its inputs, nothing else */
+#define SKIPS   2       /* reads the cell compiled after it */
+#define BOUND   4       /* only works in the word it was compiled into */
+#define QUOTES  8       /* reads or changes its caller's return stack frame */
+#define KNOWN   16      /* not pure, but its data stack effect is known */
+#define FLOW    32      /* the cell it skips is a branch destination */
+#define JUMPS   64      /* never continues with the next word */
+#define EXITS   128     /* returns from the word it was compiled into */
+
+struct effect
+{
+    code            code;
+    signed char     in, out;        /* data stack */
+    signed char     rin, rout;      /* return stack */
+    int             flags;
+    signed char     taken;          /* data stack, if the branch is taken */
+};
+
+#define known(pe)   ((pe)->flags & (PURE | KNOWN))
+
+static struct effect prims[] = {
+    { mu_nope,          0, 0,  0, 0,  PURE },
+    { mu_plus,          2, 1,  0, 0,  PURE },
+    { mu_and,           2, 1,  0, 0,  PURE },
+    { mu_or,            2, 1,  0, 0,  PURE },
+    { mu_xor,           2, 1,  0, 0,  PURE },
+    { mu_star,          2, 1,  0, 0,  PURE },
+    { mu_negate,        1, 1,  0, 0,  PURE },
+    { mu_invert,        1, 1,  0, 0,  PURE },
+    { mu_2star,         1, 1,  0, 0,  PURE },
+    { mu_2slash,        1, 1,  0, 0,  PURE },
+    { mu_u2slash,       1, 1,  0, 0,  PURE },
+    { mu_shift_left,    2, 1,  0, 0,  PURE },
+    { mu_shift_right,   2, 1,  0, 0,  PURE },
+    { mu_ushift_right,  2, 1,  0, 0,  PURE },
+    { mu_cells,         1, 1,  0, 0,  PURE },
+    { mu_cell_slash,    1, 1,  0, 0,  PURE },
+    { mu_uless,         2, 1,  0, 0,  PURE },
+    { mu_less,          2, 1,  0, 0,  PURE },
+    { mu_0less,         1, 1,  0, 0,  PURE },
+    { mu_0equal,        1, 1,  0, 0,  PURE },
+    { mu_dup,           1, 2,  0, 0,  PURE },
+    { mu_over,          2, 3,  0, 0,  PURE },
+    { mu_swap,          2, 2,  0, 0,  PURE },
+    { mu_drop,          1, 0,  0, 0,  PURE },
+    { mu_2drop,         2, 0,  0, 0,  PURE },
+    { mu_aligned,       1, 1,  0, 0,  PURE },
+
+    /* Division traps on a zero divisor, so we don't fold it. */
+    { mu_uslash_mod,    2, 2,  0, 0,  KNOWN },
+    { mu_slash_mod,     2, 2,  0, 0,  KNOWN },
+
+    { mu_cfetch,        1, 1,  0, 0,  KNOWN },
+    { mu_cstore,        2, 0,  0, 0,  KNOWN },
+    { mu_fetch,         1, 1,  0, 0,  KNOWN },
+    { mu_store,         2, 0,  0, 0,  KNOWN },
+    { mu_plus_store,    2, 0,  0, 0,  KNOWN },
+    { mu_nth,           1, 1,  0, 0,  KNOWN },
+    { mu_depth,         0, 1,  0, 0,  KNOWN },
+    { mu_string_equal,  4, 1,  0, 0,  KNOWN },
+    { mu_cmove,         3, 0,  0, 0,  KNOWN },
+    { mu_fill,          3, 0,  0, 0,  KNOWN },
+    { mu_zcount,        1, 2,  0, 0,  KNOWN },
+
+    { mu_push_h0,       0, 1,  0, 0,  KNOWN },
+    { mu_here,          0, 1,  0, 0,  KNOWN },
+    { mu_comma,         1, 0,  0, 0,  KNOWN },
+    { mu_allot,         1, 0,  0, 0,  KNOWN },
+    { mu_linked_name_,  3, 0,  0, 0,  KNOWN },
+    { mu_muchain_comma, 1, 0,  0, 0,  KNOWN },
+    { mu_journal_store, 2, 0,  0, 0,  KNOWN },
+    { mu_dict_mark,     0, 1,  0, 0,  KNOWN },
+    { mu_literal,       1, 0,  0, 0,  KNOWN },
+    { mu_compile_comma, 1, 0,  0, 0,  KNOWN },
+
+    { mu_push_line,     0, 1,  0, 0,  KNOWN },
+    { mu_at_line,       0, 1,  0, 0,  KNOWN },
+    { mu_push_zloading, 0, 1,  0, 0,  KNOWN },
+    { mu_pad,           0, 1,  0, 0,  KNOWN },
+    { mu_push_scratch,  0, 1,  0, 0,  KNOWN },
+    { mu_scratch_allot, 1, 1,  0, 0,  KNOWN },
+    { mu_push_first,    0, 1,  0, 0,  KNOWN },
+    { mu_push_start,    0, 1,  0, 0,  KNOWN },
+    { mu_push_end,      0, 1,  0, 0,  KNOWN },
+    { mu_push_parsed,   0, 2,  0, 0,  KNOWN },
+    { mu_push_skipped,  0, 2,  0, 0,  KNOWN },
+    { mu_push_trailing, 0, 2,  0, 0,  KNOWN },
+    { mu_token,         0, 2,  0, 0,  KNOWN },
+    { mu_parse,         1, 2,  0, 0,  KNOWN },
+    { mu_push_command_line, 0, 2, 0, 0, KNOWN },
+    { mu_push_clock,    0, 1,  0, 0,  KNOWN },
+    { mu_push_nanoclock, 0, 1, 0, 0,  KNOWN },
+    { mu_push_tick_abort, 0, 1, 0, 0, KNOWN },
+
+    { mu_create_file,   1, 1,  0, 0,  KNOWN },
+    { mu_open_file_ro,  1, 1,  0, 0,  KNOWN },
+    { mu_open_file_wo,  1, 1,  0, 0,  KNOWN },
+    { mu_open_file_rw,  1, 1,  0, 0,  KNOWN },
+    { mu_close_file,    1, 0,  0, 0,  KNOWN },
+    { mu_read_file,     1, 2,  0, 0,  KNOWN },
+    { mu_read_carefully,  3, 1,  0, 0,  KNOWN },
+    { mu_write_carefully, 3, 0,  0, 0,  KNOWN },
+
+    { mu_runtime_to_r,      1, 0,  0, 1,  PURE },
+    { mu_runtime_push,      1, 0,  0, 1,  PURE },
+    { mu_runtime_r_from,    0, 1,  1, 0,  PURE },
+    { mu_runtime_pop,       0, 1,  1, 0,  PURE },
+    { mu_runtime_rfetch,    0, 1,  1, 1,  PURE },
+    { mu_runtime_2to_r,     2, 0,  0, 2,  PURE },
+    { mu_runtime_2push,     2, 0,  0, 2,  PURE },
+    { mu_runtime_2r_from,   0, 2,  2, 0,  PURE },
+    { mu_runtime_2pop,      0, 2,  2, 0,  PURE },
+    { mu_runtime_2rfetch,   0, 2,  2, 2,  PURE },
+    { mu_runtime_rdrop,     0, 0,  1, 0,  PURE },
+    { mu_runtime_2rdrop,    0, 0,  2, 0,  PURE },
+    { mu_runtime_shunt,     0, 0,  1, 0,  PURE },
+
+    { mu_runtime_exit,      0, 0,  0, 0,  KNOWN | EXITS | JUMPS },
+    { mu_runtime_lit_,      0, 1,  0, 0,  SKIPS | KNOWN },
+    { mu_runtime_compile,   0, 0,  0, 0,  SKIPS | KNOWN },
+
+    /* (do) "branches" to the end of the loop when we leave. */
+    { mu_runtime_branch_,         0, 0,  0, 0,  SKIPS|BOUND|KNOWN|FLOW|JUMPS,  0 },
+    { mu_runtime_equal_0branch_,  0, 0,  0, 0,  SKIPS|BOUND|KNOWN|FLOW,  0 },
+    { mu_runtime_0branch_,        1, 0,  0, 0,  SKIPS|BOUND|KNOWN|FLOW, -1 },
+    { mu_runtime_q0branch_,       0, 0,  0, 0,  SKIPS|BOUND|KNOWN|FLOW, -1 },
+    { mu_runtime_next_,           0, 0,  1, 0,  SKIPS|BOUND|KNOWN|FLOW,  0 },
+    { mu_runtime_do_,             2, 0,  0, 3,  SKIPS|BOUND|KNOWN|FLOW, -2 },
+    { mu_runtime_loop_,           0, 0,  3, 0,  SKIPS|BOUND|KNOWN|FLOW,  0 },
+    { mu_runtime_plus_loop_,      1, 0,  3, 0,  SKIPS|BOUND|KNOWN|FLOW, -1 },
+    { mu_runtime_leave,           0, 0,  3, 3,  BOUND | KNOWN | JUMPS },
+    { mu_runtime_qleave,          1, 0,  3, 3,  BOUND | KNOWN },
+    { mu_runtime_i,               0, 1,  2, 2,  KNOWN },
+    { mu_runtime_j,               0, 1,  5, 5,  KNOWN },
+    { mu_runtime_k,               0, 1,  8, 8,  KNOWN },
+    { mu_runtime_rp_store,        1, 0,  0, 0,  BOUND | KNOWN },
+    { mu_runtime_rp_plus_store,   1, 0,  0, 0,  BOUND | KNOWN },
+    { mu_runtime_rp_fetch,        0, 1,  0, 0,  BOUND | KNOWN },
+    { mu_execute,                 0, 0,  0, 0,  BOUND },
+    { mu_abort,                   1, 0,  0, 0,  BOUND | KNOWN | JUMPS },
+    { mu_complain,                2, 0,  0, 0,  KNOWN | JUMPS },
+    { mu_bye,                     0, 0,  0, 0,  KNOWN | JUMPS },
+
+    { NULL, 0, 0, 0, 0, 0 }
+};
+
+/*
+ * What we know about colon words
+ *
+ * We follow along as each colon word is compiled. Everything compiled by
+ * literal, compile, and compile is seen. For the return stack we simply
+ * add up the effects of everything in the body, branches and all; this is
+ * enough to tell whether the word ever reaches into its caller's frame.
+ *
+ * For the data stack we simulate the word's effect, following branches: a
+ * forward branch carries its depth to the place it is resolved to, and a
+ * backward branch has to agree with the depth we had at its destination.
+ * So do all the exits. Anything compiled by other means - with , say -
+ * that isn't the cell after a SKIPS word ends the part of the body that we
+ * know about, and the effect of the word is unknown.
+ *
+ * A colon word is pure if its effect is known, it has no branches, and
+ * everything in it is a literal or a pure word.
+ */
+struct colon
+{
+    xt              word;           /* code field; NULL if slot unused */
+    xt_cell         *end;           /* end of the part of body we've seen */
+    xt_cell         *exit;          /* the ^ that ends a straight line */
+    int             finished;       /* we've stopped following it */
+    int             known;          /* data stack effect is known so far */
+    int             pure;           /* only literals and pure words */
+    int             flow;           /* has branches or conditional exits */
+    int             bound;          /* can't be copied into another word */
+    int             marked;         /* inline even if longer than usual */
+    int             depth, low;     /* data stack depth: current and lowest */
+    int             exits;          /* how many ^ we reached */
+    int             exit_depth;     /* data stack depth at each of them */
+    int             in, out;        /* its effect, once finished */
+    int             declared;       /* it starts with a stack comment: */
+    int             din, dout;      /* this one */
+    int             rdepth, rlow;   /* return stack depth: same */
+};
+
+static struct colon *colons;        /* open-addressed hash table */
+static size_t colons_size;          /* always a power of two */
+static size_t colons_used;
+
+static struct colon *current;       /* colon word being compiled */
+static int seeing;                  /* seen everything in current so far */
+static int reachable;               /* can the next word be reached? */
+static int suspended;               /* compiled a QUOTES word into current */
+static cell *quoted;                /* here, just after a SKIPS word */
+
+static code colon_code;             /* code field of every colon word */
+static code does_code;              /* code field of every <does> word */
+static xt lit_xt;                   /* (lit) and ^; we look them up */
+static xt exit_xt;                  /* when the first colon word starts */
+
+/*
+ * Branches in current that we haven't yet followed to their destination,
+ * and the depth of the data stack at each place we compiled something.
+ */
+struct branch
+{
+    cell            *src;           /* the cell holding the destination */
+    int             depth;          /* data stack depth if taken */
+};
+
+struct point
+{
+    cell            *at;
+    int             depth;
+    int             live;           /* reachable */
+};
+
+static struct branch *branches;
+static int nbranches, branches_size;
+static struct point *points;
+static int npoints, points_size;
+
+static void *grow(void *p, int *psize, size_t elsize)
+{
+    *psize = *psize ? 2 * *psize : 64;
+    p = realloc(p, *psize * elsize);
+    if (p == NULL)
+        die("couldn't allocate memory");
+    return p;
+}
+
+static struct colon *colon_slot(xt word)
+{
+    size_t i = ((addr)word >> 3) * 2654435761u;
+
+    for (;; i++)
+    {
+        struct colon *pc = &colons[i & (colons_size - 1)];
+        if (pc->word == word || pc->word == NULL) return pc;
+    }
+}
+
+static struct colon *find_colon(xt word)
+{
+    struct colon *pc;
+
+    if (colons == NULL) return NULL;
+    pc = colon_slot(word);
+    return (pc->word == word) ? pc : NULL;
+}
+
+static struct colon *new_colon(xt word)
+{
+    struct colon *pc;
+
+    if (2 * (colons_used + 1) > colons_size)
+    {
+        struct colon *old = colons;
+        size_t old_size = colons_size;
+
+        colons_size = old_size ? 2 * old_size : 4096;
+        colons = (struct colon *)calloc(colons_size, sizeof(struct colon));
+        if (colons == NULL)
+            die("couldn't allocate memory");
+
+        for (pc = old; pc < old + old_size; pc++)
+            if (pc->word != NULL) *colon_slot(pc->word) = *pc;
+        free(old);
+    }
+
+    pc = colon_slot(word);
+    if (pc->word == NULL) colons_used++;
+    memset(pc, 0, sizeof(struct colon));
+    pc->word = word;
+    return pc;
+}
+
+static xt runtime_word(char *name)
+{
+    PUSH_ADDR(name);
+    PUSH(strlen(name));
+    muboot_push_runtime_chain();
+    mu_find();
+    if (!POP) die("couldn't find a runtime word");
+    return (xt)POP;
+}
+
+/*
+ * Stop following current. Its effect is known only if we saw all of it,
+ * every branch went somewhere we could follow, and it returns.
+ */
+static void finish()
+{
+    if (current == NULL || current->finished) return;
+
+    current->finished = 1;
+    if (!seeing || nbranches > 0 || current->exits == 0)
+        current->known = 0;
+    if (current->known)
+    {
+        current->in = -current->low;
+        current->out = current->exit_depth - current->low;
+    }
+    nbranches = npoints = 0;
+}
+
+/* Called by <:> after it has compiled a colon code field. */
+void colon_started()
+{
+    xt_cell *body = (xt_cell *)dict_here();
+
+    if (lit_xt == NULL)
+    {
+        lit_xt = runtime_word("(lit)");
+        exit_xt = runtime_word("^");
+    }
+
+    finish();
+    colon_code = _STAR((xt)body - 1);
+    current = new_colon((xt)body - 1);
+    current->end = body;
+    current->known = 1;
+    current->pure = 1;
+    seeing = 1;
+    reachable = 1;
+    suspended = 0;
+    quoted = NULL;
+    forget_literals();
+    coverage_defined(current->word);
+}
+
+/* Called by <does> after it has compiled a does code field. */
+void does_started()
+{
+    does_code = _STAR((xt)dict_here() - 1);
+}
+
+/*
+ * Find the effect of word. Colon words are only known once we have
+ * finished following them.
+ *
+ * A colon word that reaches below its own frame - popping its return
+ * address, say - QUOTES. So does a <does> word whose does code does the
+ * same; we look at the first few cells of the does code to find out, and
+ * to find its effect.
+ */
+#define DOES_SCAN_MAX   8       /* how far to look into does code */
+#define DOES_DEPTH_MAX  4       /* how deeply to follow does words */
+
+static void effect(xt word, struct effect *pe);
+
+static void does_effect(xt word, struct effect *pe)
+{
+    static int nesting;
+    xt_cell *ip = (xt_cell *)_(word[1]);
+    struct effect e;
+    int depth = 1, low = 0;         /* it starts by pushing its body */
+    int rdepth = 0;
+    int sure = 1;
+    int n;
+
+    pe->flags = QUOTES;
+    if (ip == NULL || nesting == DOES_DEPTH_MAX) return;
+    nesting++;
+    for (n = 0; n < DOES_SCAN_MAX; n++, ip++)
+    {
+        if (_STAR(ip) == exit_xt) break;
+        effect(_STAR(ip), &e);
+        if (e.flags & (BOUND | QUOTES)) break;
+        if (e.flags & SKIPS) ip++;
+        if (!known(&e)) sure = 0;
+        depth -= e.in;
+        if (depth < low) low = depth;
+        depth += e.out;
+        rdepth -= e.rin;
+        if (rdepth < 0) break;
+        rdepth += e.rout;
+    }
+    nesting--;
+    if (n == DOES_SCAN_MAX || _STAR(ip) != exit_xt || rdepth != 0) return;
+
+    pe->flags = 0;
+    if (sure)
+    {
+        pe->in = -low;
+        pe->out = depth - low;
+        pe->flags = KNOWN;
+    }
+}
+
+static void effect(xt word, struct effect *pe)
+{
+    struct effect *pp;
+    struct colon *pc;
+
+    memset(pe, 0, sizeof(struct effect));
+
+    if (_STAR(word) == colon_code)
+    {
+        pc = find_colon(word);
+        if (pc == NULL || !pc->finished)
+        {
+            pe->flags = QUOTES;
+            return;
+        }
+        if (pc->rlow < 0)
+        {
+            /* It uses -rlow cells of R; one is its own return address. */
+            pe->flags = QUOTES;
+            pe->rin = -pc->rlow - 1;
+            pe->rout = pe->rin + pc->rdepth;
+            if (pe->rout < 0) pe->rout = 0;
+            return;
+        }
+        pe->rout = pc->rdepth;
+        if (pc->known && pc->rdepth == 0)
+        {
+            pe->in = pc->in;
+            pe->out = pc->out;
+            pe->flags = (pc->pure && !pc->flow) ? PURE : KNOWN;
+        }
+        return;
+    }
+
+    if (_STAR(word) == does_code)
+    {
+        does_effect(word, pe);
+        return;
+    }
+
+    for (pp = prims; pp->code != NULL; pp++)
+        if (_STAR(word) == pp->code)
+        {
+            *pe = *pp;
+            return;
+        }
+}
+
+/* Control arrives here, from a branch, with the data stack this deep. */
+static void arrive(int depth)
+{
+    if (!reachable)
+    {
+        current->depth = depth;
+        reachable = 1;
+    }
+    else if (current->depth != depth)
+        current->known = 0;
+}
+
+/*
+ * Follow any branches that have been resolved since we last looked. A
+ * forward branch has to have been resolved to here; a backward one to
+ * somewhere we have been, with the same depth.
+ */
+static void settle()
+{
+    cell *here = dict_here();
+    int i = 0;
+
+    while (i < nbranches)
+    {
+        cell *src = branches[i].src;
+        cell *dest = (cell *)*src;
+        int j;
+
+        if (dest == NULL)
+        {
+            i++;
+            continue;
+        }
+
+        if (dest > src)
+        {
+            if (dest == here)
+                arrive(branches[i].depth);
+            else
+                current->known = 0;
+        }
+        else
+        {
+            for (j = npoints - 1; j >= 0; j--)
+                if (points[j].at == dest) break;
+            if (j < 0 || !points[j].live || points[j].depth != branches[i].depth)
+                current->known = 0;
+        }
+        branches[i] = branches[--nbranches];
+    }
+
+    if (npoints == points_size)
+        points = grow(points, &points_size, sizeof(struct point));
+    points[npoints].at = here;
+    points[npoints].depth = current->depth;
+    points[npoints].live = reachable;
+    npoints++;
+}
+
+/* Note that we are about to compile something with effect pe. */
+static void follow(struct effect *pe)
+{
+    if (current == NULL || current->finished) return;
+
+    current->rdepth -= pe->rin;
+    if (current->rdepth < current->rlow) current->rlow = current->rdepth;
+    current->rdepth += pe->rout;
+
+    if (pe->flags & (BOUND | QUOTES)) current->bound = 1;
+
+    if (!seeing) return;
+
+    /* Something else compiled code since we last looked? Only the cell
+     * after a SKIPS word - a branch destination, say - may be. */
+    if ((cell *)current->end != dict_here())
+    {
+        if ((cell *)current->end != quoted || dict_here() != quoted + 1)
+        {
+            seeing = 0;
+            return;
+        }
+        current->end = (xt_cell *)dict_here();
+    }
+
+    settle();
+    if (!reachable) return;
+
+    if (!known(pe)) current->known = 0;
+    if (!(pe->flags & PURE)) current->pure = 0;
+
+    if (pe->flags & FLOW)
+    {
+        int taken = current->depth + pe->taken;
+
+        if (taken < current->low) current->low = taken;
+        if (nbranches == branches_size)
+            branches = grow(branches, &branches_size, sizeof(struct branch));
+        branches[nbranches].src = dict_here() + 1;
+        branches[nbranches].depth = taken;
+        nbranches++;
+        current->flow = 1;
+    }
+
+    current->depth -= pe->in;
+    if (current->depth < current->low) current->low = current->depth;
+    current->depth += pe->out;
+
+    if (pe->flags & EXITS)
+    {
+        if (current->exits++ == 0)
+            current->exit_depth = current->depth;
+        else if (current->exit_depth != current->depth)
+            current->known = 0;
+
+        if (current->exits == 1 && !current->flow)
+            current->exit = (xt_cell *)dict_here();
+    }
+
+    if (pe->flags & JUMPS) reachable = 0;
+}
+
+static void followed()
+{
+    if (seeing) current->end = (xt_cell *)dict_here();
+}
+
+/*
+ * Pending literals
+ *
+ * pending[] holds the address of each pending literal's (lit), oldest
+ * first. They are pending only while the code ends right where the last
+ * of them does.
+ */
+#define PENDING_MAX     8
+
+static cell *pending[PENDING_MAX];
+static int npending;
+static cell *pending_end;
+
+void forget_literals()
+{
+    npending = 0;
+}
+
+static int literals_pending()
+{
+    if (npending > 0 && pending_end != dict_here())
+        npending = 0;
+    return npending;
+}
+
+static void compile_literal(cell n)
+{
+    static struct effect lit_effect = { NULL, 0, 1, 0, 0, PURE };
+
+    literals_pending();
+    if (npending == PENDING_MAX)
+    {
+        memmove(&pending[0], &pending[1], (PENDING_MAX - 1) * sizeof(cell *));
+        npending--;
+    }
+
+    follow(&lit_effect);
+    pending[npending++] = dict_here();
+    PUSH_ADDR(lit_xt);
+    mu_comma();
+    PUSH(n);
+    mu_comma();
+    pending_end = dict_here();
+    followed();
+}
+
+/* Take back the last n pending literals; push their values. */
+static void uncompile_literals(int n)
+{
+    cell *p;
+    int i;
+
+    if (n == 0) return;
+    p = pending[npending - n];
+    for (i = npending - n; i < npending; i++)
+        PUSH(pending[i][1]);
+
+    if (seeing && (cell *)current->end == dict_here())
+    {
+        if (reachable) current->depth -= n;
+        current->end = (xt_cell *)p;
+    }
+    else
+        seeing = 0;
+
+    npending -= n;
+    dict_rewind(p);
+    pending_end = p;
+}
+
+/* literal  ( n) */
+void mu_literal()
+{
+    compile_literal(POP);
+}
+
+/*
+ * Compile the xt on the stack exactly as written, noting its effect. The
+ * runtime part of compile uses this too, so we see the words that control
+ * structures compile.
+ */
+void compile_quoted()
+{
+    xt word = (xt)TOP;
+    struct effect e;
+
+    /* The cell after a SKIPS word is data. */
+    if (quoted == dict_here())
+    {
+        mu_comma();
+        followed();
+        return;
+    }
+
+    effect(word, &e);
+    follow(&e);
+    mu_comma();
+    npending = 0;
+    followed();
+
+    if (e.flags & SKIPS)  quoted = dict_here();
+    if (e.flags & QUOTES) suspended = 1;
+}
+
+/*
+ * Inlining
+ *
+ * A colon word that we saw all of, that doesn't reach into its caller's
+ * frame, and that has nothing bound to its own frame is copied into its
+ * callers if its body - up to the ^ that ends it - is at most INLINE_MAX
+ * words long, or INLINE_MARKED_MAX if it was marked by inline-always. A
+ * word and the cell that it skips count as one word.
+ *
+ * We don't inline while coverage is on; see coverage.c.
+ */
+#define INLINE_MAX          3
+#define INLINE_MARKED_MAX   16
+
+static struct colon *inlinable(xt word)
+{
+    struct colon *pc;
+    struct effect e;
+    xt_cell *ip;
+    int words;
+
+    if (!inlining || covering || _STAR(word) != colon_code) return NULL;
+
+    pc = find_colon(word);
+    if (pc == NULL || !pc->finished || pc->exit == NULL || pc->bound
+        || pc->rlow < 0 || pc->rdepth != 0)
+        return NULL;
+
+    words = 0;
+    for (ip = (xt_cell *)word + 1; ip < pc->exit; ip++, words++)
+    {
+        effect(_STAR(ip), &e);
+        if (e.flags & SKIPS) ip++;
+    }
+
+    return (words <= (pc->marked ? INLINE_MARKED_MAX : INLINE_MAX)) ? pc : NULL;
+}
+
+static void compile_inline(struct colon *pc)
+{
+    xt_cell *ip;
+
+    for (ip = (xt_cell *)pc->word + 1; ip < pc->exit; ip++)
+    {
+        if (_STAR(ip) == lit_xt)
+        {
+            compile_literal(*(cell *)++ip);
+            continue;
+        }
+        PUSH_ADDR(_STAR(ip));
+        mu_compile_comma();
+    }
+}
+
+/*
+ * Deferred words
+ *
+ * A call to a deferred word runs its does code, which fetches the word it
+ * is set to and executes that. For a word made with fast-defer, compile,
+ * instead compiles a call straight to that word and remembers where it
+ * did; when is sets the deferred word to something else, deferred!
+ * patches every one of those calls. A plain store into the body doesn't,
+ * so fast-defer words are set only with is; words made with defer aren't
+ * bound, and can be set any way.
+ *
+ * After the word it is set to, the body of a fast-defer word has a cell
+ * that holds the index + 1 of the last call site compiled - each site
+ * holds that of the one before - shifted left one bit, and a bit that
+ * says whether it has been set. Until it is set - and while it is set to a word
+ * that reaches into its caller's frame - its call sites call the deferred
+ * word itself, as before.
+ *
+ * Calls aren't bound while inlining is off, or coverage is on.
+ *
+ * The body and the patched calls are changed through the journal, so that
+ * markers can undo them; see dict.c.
+ */
+#define DEFERRED_SET    1
+
+struct site
+{
+    cell            *at;
+    cell            prev;           /* index + 1 of the previous site */
+};
+
+static struct site *sites;
+static int nsites, sites_size;
+static xt_cell *deferred_does;      /* does code of every fast-defer word */
+
+/* deferred-does!  ( ip) -- tell us what fast-defer words look like */
+void mu_deferred_does_store()
+{
+    deferred_does = (xt_cell *)POP;
+}
+
+static int is_deferred(xt word)
+{
+    return deferred_does != NULL && _STAR(word) == does_code
+        && (xt_cell *)_(word[1]) == deferred_does;
+}
+
+/* What should a call to this deferred word call? */
+static xt bound_to(xt word)
+{
+    cell *body = (cell *)word + 2;
+    xt target = (xt)(addr)body[0];
+    struct effect e;
+
+    if (!(body[1] & DEFERRED_SET)) return word;
+    effect(target, &e);
+    return (e.flags & (BOUND | QUOTES)) ? word : target;
+}
+
+static void compile_deferred(xt word)
+{
+    cell *body = (cell *)word + 2;
+    struct effect e;
+
+    /* A copy of the call wouldn't be patched, so don't inline its caller. */
+    effect(word, &e);
+    e.flags |= BOUND;
+    follow(&e);
+
+    if (nsites == sites_size)
+        sites = grow(sites, &sites_size, sizeof(struct site));
+    sites[nsites].at = dict_here();
+    sites[nsites].prev = body[1] >> 1;
+    nsites++;
+    dict_journal(&body[1]);
+    body[1] = ((cell)nsites << 1) | (body[1] & DEFERRED_SET);
+
+    TOP = (addr)bound_to(word);
+    mu_comma();
+    npending = 0;
+    followed();
+}
+
+/*
+ * deferred!  ( xt body)
+ *
+ * Set a fast-defer word, and patch the calls to it. Given the body of some
+ * other kind of word - a plain deferred word, say - just store, like
+ * journal! .
+ */
+void mu_deferred_store()
+{
+    cell *body = (cell *)TOP;
+    xt word = (xt)(body - 2);
+    xt was, now;
+    cell i;
+
+    if (!is_deferred(word))
+    {
+        mu_journal_store();
+        return;
+    }
+
+    was = bound_to(word);
+    dict_journal(&body[0]);
+    body[0] = ST1;
+    dict_journal(&body[1]);
+    body[1] |= DEFERRED_SET;
+    now = bound_to(word);
+    DROP(2);
+
+    if (now == was) return;
+    for (i = body[1] >> 1; i != 0; i = sites[i-1].prev)
+    {
+        cell *at = sites[i-1].at;
+
+        /* Skip any that have been taken back. */
+        if (at >= dict_here() || *at != (addr)was) continue;
+        dict_journal(at);
+        *at = (addr)now;
+    }
+}
+
+/* The dictionary has been cut back to here; forget calls compiled above. */
+void forget_sites(cell *here)
+{
+    while (nsites > 0 && sites[nsites-1].at >= here)
+        nsites--;
+}
+
+/* inline-always  -- mark the last colon word to be copied into its callers */
+void mu_inline_always()
+{
+    if (current != NULL) current->marked = 1;
+}
+
+/* compile,  ( xt) */
+void mu_compile_comma()
+{
+    xt word = (xt)TOP;
+    struct effect e;
+    struct colon *pc;
+    cell results[4];
+    int i;
+
+    if (quoted == dict_here() || suspended)
+    {
+        compile_quoted();
+        return;
+    }
+
+    effect(word, &e);
+    if (folding && (e.flags & PURE) && literals_pending() >= e.in
+        && e.rin == 0 && e.rout == 0
+        && e.out <= 4 && (e.in > 0 || e.out > 0))
+    {
+        DROP(1);
+        uncompile_literals(e.in);
+        PUSH_ADDR(word);
+        mu_execute();
+        for (i = e.out; i > 0; i--)
+            results[i-1] = POP;
+        for (i = 0; i < e.out; i++)
+            compile_literal(results[i]);
+        return;
+    }
+
+    if ((pc = inlinable(word)) != NULL)
+    {
+        DROP(1);
+        compile_inline(pc);
+        return;
+    }
+
+    if (inlining && !covering && is_deferred(word))
+    {
+        compile_deferred(word);
+        return;
+    }
+
+    compile_quoted();
+}
+
+/*
+ * literal?  ( - n -1 | 0)
+ *
+ * If the last thing compiled was a literal, take it back and return its
+ * value. The conditional control structures use this to compile constant
+ * conditions as either nothing or an unconditional branch.
+ */
+void mu_literal_q()
+{
+    if (folding && !suspended && literals_pending())
+    {
+        uncompile_literals(1);
+        PUSH(-1);
+        return;
+    }
+    PUSH(0);
+}
+
+/*
+ * Stack effects
+ *
+ * A stack comment that starts a colon word - ( a b - c) - declares its
+ * effect: the words before the - are its inputs, and those after it are
+ * its outputs. A comment with alternatives, with a variable number of
+ * items - i*x, or .. - or that describes its result - lo <= n < hi -
+ * declares nothing we can check.
+ */
+
+/* declared  ( a u)  -- parsed text of a comment */
+void mu_declared()
+{
+    char *p = (char *)ST1;
+    char *end = p + TOP;
+    int in = 0, out = 0, dash = 0;
+
+    DROP(2);
+    if (current == NULL || current->finished
+        || dict_here() != (cell *)((xt_cell *)current->word + 1))
+        return;
+
+    while (p < end)
+    {
+        char *token;
+        size_t len;
+
+        while (p < end && isspace(*p)) p++;
+        if (p == end) break;
+        for (token = p; p < end && !isspace(*p); p++) ;
+        len = p - token;
+
+        if ((len == 1 && *token == '-') || (len == 2 && !strncmp(token, "--", 2)))
+        {
+            if (dash++) return;
+            continue;
+        }
+        if ((len == 1 && *token == '|') || memchr(token, '*', len))
+            return;
+        if (strspn(token, "<=>") >= len) return;
+        for (; token + 1 < p; token++)
+            if (token[0] == '.' && token[1] == '.') return;
+        if (dash) out++; else in++;
+    }
+
+    if (!dash) return;
+    current->declared = 1;
+    current->din = in;
+    current->dout = out;
+}
+
+/* effect  ( xt - in out -1 | 0) */
+void mu_effect()
+{
+    struct effect e;
+
+    effect((xt)TOP, &e);
+    if (!known(&e))
+    {
+        TOP = 0;
+        return;
+    }
+    TOP = e.in;
+    PUSH(e.out);
+    PUSH(-1);
+}
+
+/*
+ * effect-mismatch?  ( - din dout in out -1 | 0)
+ *
+ * Stop following the last colon word. If it declared an effect that
+ * doesn't match the one it compiled to, return both. A word that declares
+ * inputs it passes through untouched still matches.
+ */
+void mu_effect_mismatch_q()
+{
+    struct colon *pc = current;
+
+    finish();
+    if (pc == NULL || !pc->declared || !pc->known
+        || (pc->din - pc->dout == pc->in - pc->out && pc->din >= pc->in))
+    {
+        PUSH(0);
+        return;
+    }
+    PUSH(pc->din);
+    PUSH(pc->dout);
+    PUSH(pc->in);
+    PUSH(pc->out);
+    PUSH(-1);
+}
@@ -84,12 +84,12 @@ ldflags=""
 # Keep Wnarrowing, because we might be building a 32-bit executable.
 # But default to whatever Darwin wants to build.
 if [ "$os" = "Darwin" ]; then
-    archobjs="file.o main.o time.o tty.o select.o pty.o usb-darwin.o"
+    archobjs="file.o main.o time.o tty.o select.o pty.o process.o usb-darwin.o"
     cflags="-mdynamic-no-pic"
     ldflags="-framework CoreFoundation -framework IOKit"
 fi
 if [ "$os" = "Linux" ]; then
-    archobjs="file.o main.o time.o tty.o select.o pty.o usb-linux.o"
+    archobjs="file.o main.o time.o tty.o select.o pty.o process.o usb-linux.o"
 
     if [ "$cpu" = "x86_64" ]; then
         Wnarrowing=""
@@ -173,7 +173,7 @@ fi
 if [ "$os" = "FreeBSD" ]; then
     # For FreeBSD, include both old-style and new-style USB drivers. Let
     # the C preprocessor decide which code to include. ;-)
-    archobjs="file.o main.o time.o tty.o select.o pty.o usb-netbsd.o usb-freebsd.o"
+    archobjs="file.o main.o time.o tty.o select.o pty.o process.o usb-netbsd.o usb-freebsd.o"
     if [ "$cpu" = "amd64" ]; then
         Wnarrowing=""
     fi
@@ -181,7 +181,7 @@ fi
 
 if [ "$os" = "DragonFly" -o "$os" = "NetBSD" -o "$os" = "OpenBSD" ]; then
     # DragonFly, NetBSD, and OpenBSD all have a NetBSD-like USB stack.
-    archobjs="file.o main.o time.o tty.o select.o pty.o usb-netbsd.o"
+    archobjs="file.o main.o time.o tty.o select.o pty.o process.o usb-netbsd.o"
     if [ "$cpu" = "amd64" -o "$cpu" = "x86_64" ]; then
         Wnarrowing=""
     fi
@@ -0,0 +1,126 @@
+/*
+ * This file is part of muforth: https://muforth.nimblemachines.com/
+ *
+ * Copyright (c) 2002-2021 David Frech. (Read the LICENSE for details.)
+ */
+
+/* coverage: which colon words have ever been executed? */
+
+#include "muforth.h"
+#include <stdlib.h>
+
+/*
+ * With coverage on, we note where each colon word is defined - the file
+ * being loaded and the line its name is on - and mu_execute marks the
+ * code field of every word it runs. .coverage in startup.mu4 lists the
+ * words that were defined but never executed.
+ *
+ * Marks are kept one bit per dictionary cell. When coverage is off the
+ * only cost is the test that mu_execute makes before it starts running
+ * threaded code.
+ *
+ * A word copied into its callers is never executed itself, so while
+ * coverage is on, compile, doesn't inline.
+ */
+
+int covering;
+
+static unsigned char *executed;     /* one bit per dictionary cell */
+static cell *h0;
+
+struct site
+{
+    xt              word;
+    char            *zfile;         /* zloading when it was defined */
+    int             line;
+    int             named;          /* -: words have no name */
+};
+
+static struct site *sites;
+static int nsites, sites_size;
+
+/* +coverage  -- note definitions and mark words as they execute */
+/* -coverage  -- stop -- DEFAULT */
+void mu_plus_coverage()
+{
+    if (executed == NULL)
+    {
+        executed = calloc(DICT_CELLS / 8, 1);
+        if (executed == NULL)
+            die("couldn't allocate memory");
+        mu_push_h0();
+        h0 = (cell *)POP;
+    }
+    covering = 1;
+}
+
+void mu_minus_coverage()  { covering = 0; }
+
+void cover(xt word)
+{
+    size_t i = (cell *)word - h0;
+
+    if (i < DICT_CELLS) executed[i >> 3] |= 1 << (i & 7);
+}
+
+/*
+ * Filenames live in the scratch arena only while their file is loading,
+ * so we keep copies. Words from the same file share one.
+ */
+static char *file_name(char *zfile)
+{
+    char *last = nsites ? sites[nsites-1].zfile : NULL;
+
+    if (zfile == NULL) return NULL;
+    if (last != NULL && strcmp(last, zfile) == 0) return last;
+    if ((last = strdup(zfile)) == NULL)
+        die("couldn't allocate memory");
+    return last;
+}
+
+/* Called by <:>, with the code field of the new word. */
+void coverage_defined(xt word)
+{
+    if (!covering) return;
+
+    if (nsites == sites_size)
+    {
+        sites_size = sites_size ? 2 * sites_size : 256;
+        sites = realloc(sites, sites_size * sizeof(struct site));
+        if (sites == NULL)
+            die("couldn't allocate memory");
+    }
+    sites[nsites].word = word;
+    sites[nsites].zfile = file_name((char *)zloading);
+    sites[nsites].line = parsed_lineno;
+    sites[nsites].named = dict_named(word);
+    nsites++;
+}
+
+/* executed?  ( xt - f) */
+void mu_executed_q()
+{
+    size_t i = (cell *)TOP - h0;
+
+    TOP = (executed != NULL && i < DICT_CELLS
+           && (executed[i >> 3] & (1 << (i & 7)))) ? -1 : 0;
+}
+
+/* coverage-site  ( n - xt z" line named -1 | 0) -- nth word defined */
+void mu_coverage_site()
+{
+    cell n = TOP;
+    struct site *ps;
+
+    if (n < 0 || n >= nsites)
+    {
+        TOP = 0;
+        return;
+    }
+    ps = &sites[n];
+    TOP = (addr)ps->word;
+    PUSH_ADDR(ps->zfile);
+    PUSH(ps->line);
+    PUSH(ps->named ? -1 : 0);
+    PUSH(-1);
+}
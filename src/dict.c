@@ -9,6 +9,7 @@
 #include "muforth.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 
 /*
  * Dictionary is one unified space, just like the old days. ;-)
@@ -19,6 +20,7 @@
  */
 static cell  *ph0;  /* pointer to start of heap space */
 static cell  *ph;   /* ptr to next free cell in heap space */
+static cell  *named;    /* ph, just after the last name we created */
 
 /*
  * A struct dict_name represents what Forth folks often call a "head" - a
@@ -137,6 +139,66 @@ struct inm initial_runtime[] = {
     { NULL, NULL }
 };
 
+/*
+ * Lookup cache
+ *
+ * Each mode's token consumer searches several chains in turn, and every
+ * miss costs a full walk of the chain - and, for anchored chains, of every
+ * chain it is anchored to. Since each chain is itself a search order (it
+ * continues into its anchors through "muchain" entries; see below), we
+ * remember the outcome of a search - the entry found, or a miss - keyed on
+ * the token and the chain that was searched.
+ *
+ * Links between ordinary names never change once made; the only link
+ * fields that change are chain heads. So along with each result we record
+ * the value of every chain head crossed during the walk. A cached result
+ * is valid only as long as all those heads still hold the values they had
+ * when the result was computed. Defining a word - or hiding or showing one
+ * - on any chain in the search order therefore invalidates exactly those
+ * results that could have been affected by it.
+ *
+ * The one thing head values can't catch is the dictionary being cut back
+ * and new names being created at the same addresses; we flush everything
+ * when that happens.
+ *
+ * Only case-sensitive searches are cached.
+ */
+#define FIND_CACHE_SIZE     1024    /* must be a power of two */
+#define FIND_CACHE_TOKEN    31      /* longest token that we cache */
+#define FIND_CACHE_HEADS    8       /* most chain heads crossed per search */
+
+struct find_memo
+{
+    link_cell       *chain;         /* chain searched; NULL if unused */
+    code_cell       *code;          /* code field found; NULL if not found */
+    unsigned char   length;
+    unsigned char   nheads;
+    char            token[FIND_CACHE_TOKEN];
+    struct
+    {
+        link_cell   *plink;         /* chain head crossed ... */
+        link_cell   *head;          /* ... and its value at the time */
+    } heads[FIND_CACHE_HEADS];
+};
+
+static struct find_memo find_cache[FIND_CACHE_SIZE];
+
+static void flush_find_cache()
+{
+    memset(find_cache, 0, sizeof(find_cache));
+}
+
+static struct find_memo *find_memo_slot(
+    char *token, cell length, link_cell *chain)
+{
+    uint32_t h = 2166136261u ^ (uint32_t)((uintptr_t)chain >> 3);
+
+    while (length-- > 0)
+        h = (h ^ (unsigned char)*token++) * 16777619u;
+
+    return &find_cache[(h ^ (h >> 16)) & (FIND_CACHE_SIZE - 1)];
+}
+
 void mu_push_h0()       /* push address of start of dictionary */
 {
     PUSH_ADDR(ph0);
@@ -144,9 +206,29 @@ void mu_push_h0()       /* push address of start of dictionary */
 
 void mu_here()          /* push current _value_ of heap pointer */
 {
+    forget_literals();  /* here might be a branch destination; see compile.c */
     PUSH_ADDR(ph);
 }
 
+/* For the colon compiler, which needs to look without being seen. */
+cell *dict_here()
+{
+    return ph;
+}
+
+/* Does word's code field follow the name we created last? */
+int dict_named(xt word)
+{
+    return (cell *)word == named;
+}
+
+/* Take back code compiled since p. */
+void dict_rewind(cell *p)
+{
+    assert(p <= ph, "dict_rewind can't go forward");
+    ph = p;
+}
+
 /*
  * , (comma) copies the cell on the top of the stack into the dictionary,
  * and advances the heap pointer by one cell. Note that ph is kept
@@ -165,11 +247,128 @@ void mu_comma()
  * Takes a count of bytes, rounds it up to a cell boundary, and adds it to
  * the heap pointer. Again, this keeps ph always aligned.
  */
-void mu_allot()    { ph += ALIGNED(POP) / sizeof(cell); }
+void mu_allot()
+{
+    cell n = POP;
+
+    /*
+     * Giving space back can leave cached lookups pointing at names that
+     * are about to be overwritten.
+     */
+    if (n < 0) flush_find_cache();
+    ph += ALIGNED(n) / sizeof(cell);
+}
 
 /* Align TOP to cell boundary */
 void mu_aligned()  { TOP = ALIGNED(TOP); }
 
+/*
+ * Markers
+ *
+ * To rebuild a target in a running muforth we have to throw away
+ * everything the last build added to the dictionary. Cutting back the heap
+ * pointer takes care of the new words themselves, but not of the cells,
+ * below the cut, that point to them: the heads of chains that were already
+ * there, their filters, and deferred words that were set to new code.
+ *
+ * So, once a marker is set, every change to one of those cells is
+ * journalled: we note its address and its value before the first change.
+ * Cells above the newest marker aren't journalled, since rolling back
+ * throws them away. Rolling back replays the journal backwards, so it
+ * takes time proportional to the number of cells changed, not to the size
+ * of the dictionary.
+ *
+ * A marker is itself an entry in the journal, with a NULL address, that
+ * remembers where the previous marker was. Markers nest.
+ */
+struct journal_entry
+{
+    cell    *where;     /* NULL for a marker */
+    cell    was;        /* old value; for a marker, the previous marked_ph */
+};
+
+static struct journal_entry *journal_entries;
+static int journal_depth, journal_size;
+static cell *marked_ph;     /* ph when the newest marker was set */
+
+static void journal_push(cell *where, cell was)
+{
+    if (journal_depth == journal_size)
+    {
+        journal_size = journal_size ? 2 * journal_size : 256;
+        journal_entries = realloc(journal_entries,
+                                  journal_size * sizeof(struct journal_entry));
+        if (journal_entries == NULL)
+            die("couldn't allocate memory");
+    }
+    journal_entries[journal_depth].where = where;
+    journal_entries[journal_depth].was = was;
+    journal_depth++;
+}
+
+/* Note the value of a cell that we are about to change. */
+void dict_journal(cell *where)
+{
+    int i;
+
+    if (marked_ph == NULL || where < ph0 || where >= marked_ph) return;
+
+    /* Only its value before the first change matters. */
+    for (i = journal_depth - 1; journal_entries[i].where != NULL; i--)
+        if (journal_entries[i].where == where) return;
+
+    journal_push(where, *where);
+}
+
+/* journal!  ( x a) -- store, in a way that markers can undo */
+void mu_journal_store()
+{
+    cell *where = (cell *)TOP;
+
+    dict_journal(where);
+    *where = ST1;
+    DROP(2);
+}
+
+/* dict-mark  ( - m) */
+void mu_dict_mark()
+{
+    journal_push(NULL, (cell)marked_ph);
+    marked_ph = ph;
+    PUSH(journal_depth - 1);
+}
+
+/*
+ * dict-rollback  ( m)
+ *
+ * Undo every journalled change since marker m was set, cut the dictionary
+ * back to where it was then, and forget m and any markers set after it.
+ */
+void mu_dict_rollback()
+{
+    cell m = POP;
+    struct journal_entry *pj;
+
+    assert(0 <= m && m < journal_depth && journal_entries[m].where == NULL,
+           "not a dictionary marker");
+
+    while (journal_depth > m)
+    {
+        pj = &journal_entries[--journal_depth];
+        if (pj->where == NULL)
+        {
+            ph = marked_ph;
+            marked_ph = (cell *)pj->was;
+        }
+        else
+            *pj->where = pj->was;
+    }
+    if (named > ph) named = NULL;
+    forget_sites(ph);
+    forget_literals();
+    flush_find_cache();
+}
+
 /* Type of string compare functions */
 typedef int (*match_fn_t)(const char*, const char*, size_t);
 
@@ -183,6 +382,129 @@ match_fn_t match = strncmp;
 void mu_plus_case()   { match = strncmp; }
 void mu_minus_case()  { match = strncasecmp; }
 
+static void remember_find(struct find_memo *pm, struct find_memo *pmemo,
+    char *token, cell length, link_cell *chain, code_cell *code)
+{
+    *pm = *pmemo;
+    pm->chain = chain;
+    pm->code = code;
+    pm->length = length;
+    memcpy(pm->token, token, length);
+}
+
+/*
+ * Chain filters
+ *
+ * Most searches in the meta-compilers miss in the first chains they look
+ * at, and many of those chains are tiny. Each chain carries a small Bloom
+ * filter over the names defined on it, so that a search can usually tell
+ * without walking a chain that a token isn't there, and skip straight to
+ * the chain's anchor.
+ *
+ * A filter is BLOOM_CELLS cells of bits; each name sets two of them. Names
+ * are folded to lowercase before hashing so that the filters are valid for
+ * case-insensitive searches as well.
+ *
+ * Forth code is free to relink chains by hand - hide and show do this.
+ * (The meta-compilers move words from one chain to another with relink,
+ * which keeps both filters up to date.) So each chain also remembers the
+ * head it had when its filter was last brought up to date, and the filter
+ * is trusted only while that is still the head. When a name is added to a
+ * chain whose head has moved, we walk the chain and rebuild its filter
+ * from scratch.
+ */
+#define BLOOM_CELLS     4
+#define BLOOM_BITS      (BLOOM_CELLS * 64)
+
+struct bloom_key
+{
+    unsigned int    bit1, bit2;
+};
+
+static struct bloom_key bloom_key(char *name, cell length)
+{
+    struct bloom_key k;
+    uint32_t h = 2166136261u;
+
+    while (length-- > 0)
+        h = (h ^ (unsigned char)tolower(*name++)) * 16777619u;
+
+    k.bit1 = h % BLOOM_BITS;
+    k.bit2 = (h >> 16) % BLOOM_BITS;
+    return k;
+}
+
+/*
+ * The body of a chain follows the link field of its "muchain" name with
+ * the chain's anchor link, the head that its filter reflects, and the
+ * filter itself. See the comments above mu_do_chain().
+ */
+#define CHAIN_ANCHOR(plink)     ((link_cell *)(plink) + 1)
+#define CHAIN_FILTERED(plink)   ((link_cell *)(plink) + 2)
+#define CHAIN_BLOOM(plink)      ((uint64_t *)(plink) + 3)
+#define CHAIN_BODY_CELLS        (3 + BLOOM_CELLS)
+
+static int is_muchain_name(struct dict_name *pnm)
+{
+    return pnm->length == 0 && memcmp(pnm->suffix, "muchain", SUFFIX_LEN) == 0;
+}
+
+/* Is plink the link field of a chain's "muchain" name? */
+static int is_chain_head(link_cell *plink)
+{
+    if ((cell *)plink <= ph0 || (cell *)plink >= ph) return 0;
+    return is_muchain_name((struct dict_name *)((cell *)plink - 1));
+}
+
+static void bloom_add(link_cell *plink, struct bloom_key k)
+{
+    uint64_t *bloom = CHAIN_BLOOM(plink);
+
+    bloom[k.bit1 / 64] |= (uint64_t)1 << (k.bit1 % 64);
+    bloom[k.bit2 / 64] |= (uint64_t)1 << (k.bit2 % 64);
+}
+
+/* Could the token with key k be on the chain, before its anchor? */
+static int bloom_may_contain(link_cell *plink, struct bloom_key k)
+{
+    uint64_t *bloom = CHAIN_BLOOM(plink);
+
+    if (FOLLOW_LINK(plink) != FOLLOW_LINK(CHAIN_FILTERED(plink)))
+        return 1;   /* the filter is out of date */
+
+    return (bloom[k.bit1 / 64] >> (k.bit1 % 64) & 1)
+        && (bloom[k.bit2 / 64] >> (k.bit2 % 64) & 1);
+}
+
+/*
+ * Rebuild a chain's filter by walking the chain until we reach another
+ * chain - or the end. Wherever that is becomes the chain's anchor.
+ */
+static void refilter_chain(link_cell *plink)
+{
+    link_cell *p = plink;
+    struct dict_name *pnm;
+    int i;
+
+    dict_journal((cell *)CHAIN_ANCHOR(plink));
+    dict_journal((cell *)CHAIN_FILTERED(plink));
+    for (i = 0; i < BLOOM_CELLS; i++)
+        dict_journal((cell *)CHAIN_BLOOM(plink) + i);
+
+    memset(CHAIN_BLOOM(plink), 0, BLOOM_CELLS * sizeof(cell));
+
+    while ((p = FOLLOW_LINK(p)) != NULL)
+    {
+        pnm = (struct dict_name *)((cell *)p - 1);
+        if (is_muchain_name(pnm)) break;
+        if (pnm->length != 0)
+            bloom_add(plink,
+                bloom_key(pnm->suffix + SUFFIX_LEN - pnm->length, pnm->length));
+    }
+    FOLLOW_LINK(CHAIN_ANCHOR(plink)) = p;
+    FOLLOW_LINK(CHAIN_FILTERED(plink)) = FOLLOW_LINK(plink);
+}
+
 /*
  * find takes a token (a u) and a chain (the head of a vocab word list) and
  * searches for the token on that chain. If found, it returns the address
@@ -195,7 +517,12 @@ void mu_find()
     char *token = (char *) ST2;
     cell length = ST1;
     struct dict_entry *pde;
-    link_cell *plink = (link_cell *)TOP;
+    link_cell *chain = (link_cell *)TOP;
+    link_cell *plink = chain;
+    struct find_memo *pm = NULL;
+    struct find_memo memo;
+    struct bloom_key k;
+    int i;
 
     /*
      * Only search if 0 < length < 256. This prevents us from matching hidden
@@ -203,25 +530,87 @@ void mu_find()
      */
     if (0 < length && length < 256)
     {
+        if (match == strncmp && length <= FIND_CACHE_TOKEN)
+        {
+            pm = find_memo_slot(token, length, chain);
+
+            if (pm->chain == chain && pm->length == length
+                && memcmp(pm->token, token, length) == 0)
+            {
+                for (i = 0; i < pm->nheads; i++)
+                    if (FOLLOW_LINK(pm->heads[i].plink) != pm->heads[i].head)
+                        break;
+
+                if (i == pm->nheads)
+                {
+                    if (pm->code == NULL) goto not_found;
+                    DROP(1);
+                    ST1 = (addr)pm->code;
+                    TOP = -1;
+                    return;
+                }
+            }
+
+            /* Start recording a new memo; the chain itself is a head. */
+            memo.nheads = 1;
+            memo.heads[0].plink = chain;
+            memo.heads[0].head = FOLLOW_LINK(chain);
+        }
+
+        /*
+         * If the token can't be on this chain, carry on with the chain it
+         * is anchored to. We do this by following the link to the anchor
+         * rather than the link to the head of the chain.
+         */
+        k = bloom_key(token, length);
+        if (is_chain_head(plink) && !bloom_may_contain(plink, k))
+            plink = CHAIN_ANCHOR(plink);
+
         while ((plink = FOLLOW_LINK(plink)) != NULL)
         {
             /* convert pointer to link to pointer to suffix */
             pde = (struct dict_entry *)(plink - 1);
 
             /* for speed, don't test anything else unless lengths match */
-            if (pde->name.length != length) continue;
+            if (pde->name.length != length)
+            {
+                if (pde->name.length != 0 || !is_muchain_name(&pde->name))
+                    continue;
+
+                /* We are passing into another chain; note its head. */
+                if (pm != NULL)
+                {
+                    if (memo.nheads == FIND_CACHE_HEADS)
+                        pm = NULL;      /* too many to check cheaply */
+                    else
+                    {
+                        memo.heads[memo.nheads].plink = plink;
+                        memo.heads[memo.nheads].head = FOLLOW_LINK(plink);
+                        memo.nheads++;
+                    }
+                }
+
+                /* And skip it if we can. */
+                if (!bloom_may_contain(plink, k))
+                    plink = CHAIN_ANCHOR(plink);
+                continue;
+            }
 
             /* lengths match - compare strings */
             if ((*match)(pde->name.suffix + SUFFIX_LEN - length, token, length) != 0)
                 continue;
 
             /* found: drop token, push code address and true flag */
+            if (pm != NULL) remember_find(pm, &memo, token, length, chain,
+                                          &pde->code);
             DROP(1);
             ST1 = (addr)&pde->code;
             TOP = -1;
             return;
         }
+        if (pm != NULL) remember_find(pm, &memo, token, length, chain, NULL);
     }
+not_found:
     /* not found: leave token, push false */
     TOP = 0;
 }
@@ -268,6 +657,7 @@ static link_cell *new_name(
 
     /* Allot entry */
     ph = (cell *)(pnm + 1);
+    named = ph;
 
 #ifdef BEING_DEFINED
     fprintf(stderr, "%p %p %.*s\n", &pnm->link, link, length, name);
@@ -277,6 +667,29 @@ static link_cell *new_name(
     return &pnm->link;
 }
 
+/*
+ * A name has just been put at the front of the chain at plink, in front of
+ * head; note it in the chain's filter.
+ */
+static void filter_new_head(
+    link_cell *plink, link_cell *head, char *name, int length)
+{
+    if (!is_chain_head(plink)) return;
+
+    /*
+     * Adding to the filter only sets bits, which is harmless to undo so
+     * long as the head it reflects is undone too.
+     */
+    dict_journal((cell *)CHAIN_FILTERED(plink));
+    if (head != FOLLOW_LINK(CHAIN_FILTERED(plink)))
+        refilter_chain(plink);
+    else
+    {
+        bloom_add(plink, bloom_key(name, length));
+        FOLLOW_LINK(CHAIN_FILTERED(plink)) = FOLLOW_LINK(plink);
+    }
+}
+
 /*
  * new_linked_name creates a new, non-hidden dictionary (name) entry and
  * links it onto the chain represented by plink.
@@ -284,8 +697,14 @@ static link_cell *new_name(
 static void new_linked_name(
     link_cell *plink, char *name, int length)
 {
+    link_cell *head = FOLLOW_LINK(plink);
+
     /* create new name & link onto front of chain */
-    FOLLOW_LINK(plink) = new_name(FOLLOW_LINK(plink), name, length, 0);
+    dict_journal((cell *)plink);
+    FOLLOW_LINK(plink) = new_name(head, name, length, 0);
+
+    /* and note it in the chain's filter */
+    filter_new_head(plink, head, name, MIN(length, 255));
 }
 
 /* (linked-name)  ( a u chain) */
@@ -295,6 +714,49 @@ void mu_linked_name_()
     DROP(3);
 }
 
+/*
+ * relink  ( from to)
+ *
+ * Move the newest word on chain from to the front of chain to. The
+ * meta-compilers do this to move a word they have just defined onto
+ * another chain. Doing it here keeps both filters up to date: from's may
+ * still have bits set for the word that left, which costs nothing but the
+ * odd needless walk, and to's gains the word.
+ */
+void mu_relink()
+{
+    link_cell *from = (link_cell *)ST1;
+    link_cell *to = (link_cell *)TOP;
+    link_cell *word = FOLLOW_LINK(from);
+    link_cell *head = FOLLOW_LINK(to);
+    struct dict_name *pnm;
+    int filtered;
+
+    DROP(2);
+    if (word == NULL) return;
+
+    /* unlink from from */
+    filtered = is_chain_head(from)
+               && word == FOLLOW_LINK(CHAIN_FILTERED(from));
+    dict_journal((cell *)from);
+    FOLLOW_LINK(from) = FOLLOW_LINK(word);
+    if (filtered)
+    {
+        dict_journal((cell *)CHAIN_FILTERED(from));
+        FOLLOW_LINK(CHAIN_FILTERED(from)) = FOLLOW_LINK(from);
+    }
+
+    /* and link onto to */
+    dict_journal((cell *)word);
+    FOLLOW_LINK(word) = head;
+    dict_journal((cell *)to);
+    FOLLOW_LINK(to) = word;
+
+    pnm = (struct dict_name *)((cell *)word - 1);
+    filter_new_head(to, head, pnm->suffix + SUFFIX_LEN - pnm->length,
+                    pnm->length);
+}
+
 /*
  * Structure of dictionary chains
  *
@@ -372,6 +834,10 @@ void mu_linked_name_()
  * most-recently-defined word on the chain. (The variable current always
  * points to the link field of *some* dictionary chain.)
  *
+ * After the link field come the chain's anchor link - the initial value of
+ * the link field, which is where searches leave this chain - and the
+ * chain's filter (see bloom_key() above) and the head it reflects.
+ *
  * When executed, a dictionary chain pushes the address of its embedded
  * link field. This can then be used for dictionary searches, or to set
  * current (so that later definitions are added to the chain).
@@ -381,6 +847,19 @@ static void mu_do_chain()
     PUSH_ADDR(&W[2]);   /* push the address of muchain's link field */
 }
 
+/* Compile the hidden muchain name and an empty chain anchored at anchor. */
+static link_cell *new_muchain(link_cell *anchor)
+{
+    link_cell *plink = new_name(anchor, "muchain", 7, 1);
+
+    /* An empty chain with an empty filter. */
+    memset(ph, 0, CHAIN_BODY_CELLS * sizeof(cell));
+    FOLLOW_LINK(CHAIN_ANCHOR(plink)) = anchor;
+    FOLLOW_LINK(CHAIN_FILTERED(plink)) = anchor;
+    ph += CHAIN_BODY_CELLS;
+    return plink;
+}
+
 /*
  * Create a new chain.
  *
@@ -402,7 +881,18 @@ static link_cell *new_chain(
 {
     new_linked_name(plink, name, strlen(name));
     _STAR((code_cell *)ph++) = mu_do_chain;     /* set code pointer */
-    return new_name(NULL, "muchain", 7, 1);
+    return new_muchain(NULL);
+}
+
+/*
+ * muchain,  ( anchor-link)
+ *
+ * Compile the body of a new chain, anchored to anchor-link. Used by
+ * chain  in startup.mu4 after it has compiled a code field.
+ */
+void mu_muchain_comma()
+{
+    new_muchain((link_cell *)POP);
 }
 
 /*
@@ -490,6 +980,7 @@ void init_dict()
      * pointer in the real .forth. chain to match.
      */
     FOLLOW_LINK(forth_chain) = LINK(forth_bootstrap);
+    refilter_chain(forth_chain);
 
     /* Now we can populate the .compiler. chain with words defined in C. */
     init_chain(compiler_chain, NULL, initial_compiler);
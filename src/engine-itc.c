@@ -42,12 +42,32 @@
 
 #define CALL(xt)  (W = (xt), (_STAR(W))())
 
+/*
+ * With coverage on, we run a copy of the loop that marks each word before
+ * calling it. Coverage is rarely on, and this way testing for it costs one
+ * test per execute rather than one per NEXT.
+ */
+#define CALL_COVERED(xt)  (W = (xt), cover(W), (_STAR(W))())
+
+static void execute_covered(cell *rp_saved)
+{
+    CALL_COVERED(_STAR((xt_cell *)SP++));
+    while (RP < rp_saved)
+        CALL_COVERED(_STAR(IP++));
+}
+
 void mu_execute()
 {
     cell *rp_saved;
 
     rp_saved = RP;
 
+    if (covering)
+    {
+        execute_covered(rp_saved);
+        return;
+    }
+
     CALL(_STAR((xt_cell *)SP++));   /* pop stack and execute xt */
     while (RP < rp_saved)
         CALL(_STAR(IP++));          /* do NEXT */
@@ -71,8 +91,8 @@ static void mu_do_does()
     PUSH_ADDR(&W[2]);           /* push the address of the word's body */
 }
 
-void mu_set_colon_code() { PUSH_ADDR(&mu_do_colon); mu_comma(); }
-void mu_set_does_code()  { PUSH_ADDR(&mu_do_does);  mu_comma(); }
+void mu_set_colon_code() { PUSH_ADDR(&mu_do_colon); mu_comma(); colon_started(); }
+void mu_set_does_code()  { PUSH_ADDR(&mu_do_does);  mu_comma(); does_started(); }
 
 /* Normal exit */
 void mu_runtime_exit()      { UNNEST; }
@@ -81,7 +101,7 @@ void mu_runtime_exit()      { UNNEST; }
 void mu_runtime_lit_()      { PUSH(*(cell *)IP++); }
 
 /* Compile the following word */
-void mu_runtime_compile()   { mu_runtime_lit_(); mu_comma(); }
+void mu_runtime_compile()   { mu_runtime_lit_(); compile_quoted(); }
 
 
 /*
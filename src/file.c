@@ -13,6 +13,12 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <stdlib.h>     /* realloc */
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 /* XXX: for read, write; temporary? */
 #include <sys/uio.h>
@@ -179,6 +185,7 @@ void mu_open_file_ro_nonblocking()
 
 void mu_close_file()
 {
+    rx_forget(TOP);             /* its buffered input goes with it */
     while (close(TOP) == -1)
     {
         if (errno == EINTR) continue;
@@ -223,6 +230,262 @@ void mu_read_file()     /* fd - addr len */
     TOP = s.st_size;
 }
 
+/*
+ * Hashing, for the build cache. This is 64-bit FNV-1a: not cryptographic,
+ * but quick, and good enough to tell whether a file has changed.
+ */
+static ucell hash_bytes(ucell h, unsigned char *p, size_t len)
+{
+    while (len-- > 0)
+        h = (h ^ *p++) * 0x100000001b3ULL;
+    return h;
+}
+
+/* hash-bytes  ( h a u - h') */
+void mu_hash_bytes()
+{
+    ST2 = hash_bytes(ST2, (unsigned char *)ST1, TOP);
+    DROP(2);
+}
+
+/* hash-file  ( h z" - h' -1 | 0) -- 0 if we can't read the file */
+void mu_hash_file()
+{
+    char pathbuf[PATH_MAX];
+    char *path = abs_path(pathbuf, PATH_MAX, (char *)TOP);
+    struct stat s;
+    char *p;
+    int fd;
+
+    if (path == NULL || (fd = open(path, O_RDONLY)) == -1)
+        goto fail;
+
+    if (fstat(fd, &s) == -1)
+    {
+        close(fd);
+        goto fail;
+    }
+
+    if (s.st_size != 0)
+    {
+        p = (char *) mmap(0, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close(fd);
+            goto fail;
+        }
+        ST1 = hash_bytes(ST1, (unsigned char *)p, s.st_size);
+        munmap(p, s.st_size);
+    }
+    close(fd);
+    TOP = -1;
+    return;
+
+fail:
+    DROP(1);
+    TOP = 0;
+}
+
+/* make-directory  ( z") -- it's fine if it's already there */
+void mu_make_directory()
+{
+    char pathbuf[PATH_MAX];
+    char *path = abs_path(pathbuf, PATH_MAX, (char *)TOP);
+
+    if (path == NULL)
+        return abort_zmsg("path too long");
+
+    if (mkdir(path, 0777) == -1 && errno != EEXIST)
+        return abort_strerror();
+
+    DROP(1);
+}
+
+/*
+ * Watching files, for watch mode. See target/common/watch.mu4
+ *
+ * On Linux, inotify tells us when a watched file is written, replaced, or
+ * removed. Elsewhere we look at each file's modification time and size
+ * four times a second.
+ */
+struct watched
+{
+    char    *path;
+    int     wd;             /* inotify watch descriptor */
+    time_t  mtime;
+    off_t   size;
+};
+
+static struct watched *watched;
+static int nwatched, watched_size;
+
+#ifdef __linux__
+static int inotify_fd = -1;
+static char events[4096]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+#endif
+
+/* watch-file  ( z") */
+void mu_watch_file()
+{
+    char pathbuf[PATH_MAX];
+    char *path = abs_path(pathbuf, PATH_MAX, (char *)TOP);
+    struct watched *pw;
+    struct stat s;
+    int wd = -1;
+
+    if (path == NULL)
+        return abort_zmsg("path too long");
+
+    if (stat(path, &s) == -1)
+        return abort_strerror();
+
+#ifdef __linux__
+    if (inotify_fd == -1 && (inotify_fd = inotify_init1(IN_CLOEXEC)) == -1)
+        return abort_strerror();
+
+    wd = inotify_add_watch(inotify_fd, path, IN_MODIFY | IN_CLOSE_WRITE
+                           | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+    if (wd == -1)
+        return abort_strerror();
+#endif
+
+    if (nwatched == watched_size)
+    {
+        watched_size = watched_size ? 2 * watched_size : 64;
+        watched = realloc(watched, watched_size * sizeof(struct watched));
+        if (watched == NULL)
+            die("couldn't allocate memory");
+    }
+    pw = &watched[nwatched];
+    if ((pw->path = strdup(path)) == NULL)
+        die("couldn't allocate memory");
+    pw->wd = wd;
+    pw->mtime = s.st_mtime;
+    pw->size = s.st_size;
+    nwatched++;
+    DROP(1);
+}
+
+#ifdef __linux__
+
+/* Read some events, and return the first watched file they mention. */
+static struct watched *changed_file()
+{
+    struct inotify_event *pe;
+    ssize_t len;
+    char *p;
+    int i;
+
+    len = read(inotify_fd, events, sizeof(events));
+    for (p = events; len > 0 && p < events + len;
+         p += sizeof(struct inotify_event) + pe->len)
+    {
+        pe = (struct inotify_event *)p;
+        for (i = 0; i < nwatched; i++)
+            if (watched[i].wd == pe->wd) return &watched[i];
+    }
+    return NULL;
+}
+
+#else
+
+/* Return the first watched file whose time or size is not what it was. */
+static struct watched *changed_file()
+{
+    struct watched *pw;
+    struct stat s;
+
+    for (pw = watched; pw < watched + nwatched; pw++)
+    {
+        if (stat(pw->path, &s) == -1)
+            return pw;
+        if (s.st_mtime != pw->mtime || s.st_size != pw->size)
+        {
+            pw->mtime = s.st_mtime;
+            pw->size = s.st_size;
+            return pw;
+        }
+    }
+    return NULL;
+}
+
+#endif
+
+/*
+ * Editors often write a file in several steps. Once we've seen a change,
+ * wait until things have been quiet for a tenth of a second.
+ */
+static void settle()
+{
+    struct timeval tv;
+#ifdef __linux__
+    fd_set fds;
+
+    for (;;)
+    {
+        FD_ZERO(&fds);
+        FD_SET(inotify_fd, &fds);
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;
+        if (select(inotify_fd + 1, &fds, NULL, NULL, &tv) <= 0) return;
+        if (read(inotify_fd, events, sizeof(events)) <= 0) return;
+    }
+#else
+    tv.tv_sec = 0;
+    tv.tv_usec = 100000;
+    select(0, NULL, NULL, NULL, &tv);
+#endif
+}
+
+/*
+ * wait-for-change  ( fd - z" -1 | 0)
+ *
+ * Wait until a watched file changes, and return its name; or until there
+ * is something to read on fd, and return 0.
+ */
+void mu_wait_for_change()
+{
+    int fd = TOP;
+    int nfds = fd + 1;
+    struct watched *pw = NULL;
+    struct timeval tv, *ptv = &tv;
+    fd_set fds;
+
+#ifdef __linux__
+    if (inotify_fd > fd) nfds = inotify_fd + 1;
+    ptv = NULL;
+#endif
+
+    while (pw == NULL)
+    {
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+#ifdef __linux__
+        if (inotify_fd != -1) FD_SET(inotify_fd, &fds);
+#endif
+        tv.tv_sec = 0;
+        tv.tv_usec = 250000;
+        if (select(nfds, &fds, NULL, NULL, ptv) == -1)
+        {
+            if (errno == EINTR) continue;
+            return abort_strerror();
+        }
+        if (FD_ISSET(fd, &fds))
+        {
+            TOP = 0;
+            return;
+        }
+#ifdef __linux__
+        if (inotify_fd == -1 || !FD_ISSET(inotify_fd, &fds)) continue;
+#endif
+        pw = changed_file();
+    }
+    settle();
+    TOP = (addr)pw->path;
+    PUSH(-1);
+}
+
 void mu_read_carefully()    /* fd buffer len -- #read */
 {
     int fd;
@@ -31,6 +31,7 @@ static charptr_cell first;      /* goes from start to end */
 static cell lineno = 1;
 
 int parsed_lineno;              /* captured with first character of token */
+cell zloading;                  /* C-string name of file being loaded */
 struct string parsed;           /* for errors */
 static struct string skipped;   /* whitespace skipped before token */
 static struct string trailing;  /* whitespace skipped after token */
@@ -41,6 +42,12 @@ void mu_push_line()
     PUSH_ADDR(&lineno);
 }
 
+/* Push zloading variable */
+void mu_push_zloading()
+{
+    PUSH_ADDR(&zloading);
+}
+
 /* Push captured line number */
 void mu_at_line()
 {
@@ -206,7 +213,7 @@ static void muboot_compile_token()
     mu_find();
     if (POP)
     {
-        mu_comma();
+        mu_compile_comma();
         return;
     }
     mu_complain();
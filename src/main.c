@@ -6,21 +6,33 @@
 
 #include "muforth.h"
 
-#include <stdlib.h>     /* exit(3) */
+#include <stdlib.h>     /* exit(3), malloc(3) */
+#include <stdio.h>      /* fflush(3) */
+#include <unistd.h>     /* execvp(2) */
+#include <fcntl.h>
 
 static struct string cmd_line;
+static char **args;     /* for restart */
 
 static void convert_command_line(int argc, char *argv[])
 {
     char *copied;   /* pointer to last byte copied */
+    size_t size = 1;
+    int i;
 
     /* skip arg[0] */
     argc--;
     argv++;
 
-    /* Concatenate the args into a string in the dictionary. */
-    mu_here();
-    copied = cmd_line.data = (char *)POP;
+    /*
+     * Concatenate the args into a string of its own, rather than in the
+     * dictionary; leave room for string_copy's zero terminator.
+     */
+    for (i = 0; i < argc; i++)
+        size += strlen(argv[i]) + 1;
+    copied = cmd_line.data = malloc(size);
+    if (copied == NULL)
+        die("couldn't allocate memory");
 
     while (argc--)
     {
@@ -34,11 +46,9 @@ static void convert_command_line(int argc, char *argv[])
     /*
      * No need to null-terminate! This string is evaluated by the Forth
      * parser, not C code. Any pieces - like filenames - that get passed to
-     * C are copied out of this string into the dictionary and
-     * null-terminated first - just like input from _any other_ source.
+     * C are copied out of this string and null-terminated first - just
+     * like input from _any other_ source.
      */
-    PUSH(cmd_line.length);
-    mu_allot();
 }
 
 void mu_push_command_line()
@@ -52,8 +62,26 @@ void mu_bye()
     exit(0);
 }
 
+/*
+ * restart  -- start muforth again, from scratch, with the same command
+ * line. Files we have open - serial ports, USB devices - are closed on the
+ * way, so the new muforth can open them again. We never have more than a
+ * handful of files open, so we don't look far for them.
+ */
+void mu_restart()
+{
+    int fd;
+
+    fflush(NULL);
+    for (fd = 3; fd < 256; fd++)
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    execvp(args[0], args);
+    abort_strerror();
+}
+
 int main(int argc, char *argv[])
 {
+    args = argv;
     muforth_init();
     convert_command_line(argc, argv);
     muforth_start();
@@ -113,6 +113,7 @@ struct string
 };
 
 extern int parsed_lineno;       /* captured with first character of token */
+extern cell zloading;           /* C-string name of file being loaded */
 extern struct string parsed;    /* last token parsed */
 
 /* declare common functions */
@@ -122,6 +123,19 @@ extern struct string parsed;    /* last token parsed */
  */
 #include "public.h"
 
+/* coverage.c */
+extern int covering;
+void cover(xt word);
+void coverage_defined(xt word);
+
+/* compile.c */
+void forget_sites(cell *here);
+
+/* dict.c */
+void dict_rewind(cell *p);
+int dict_named(xt word);
+void dict_journal(cell *where);
+
 /* error.c */
 void die(const char *zmsg);
 void abort_zmsg(const char *zmsg);
@@ -131,5 +145,8 @@ void assert(int cond, const char *zmsg);
 char *string_copy(char *dest, char *src);
 char *concat_paths(char *dest, size_t destsize, char *p1, char *p2);
 
+/* tty.c */
+void rx_forget(int fd);
+
 /* Utility macros */
 #define MIN(a,b)    (((a) < (b)) ? (a) : (b))
@@ -0,0 +1,103 @@
+/*
+ * This file is part of muforth: https://muforth.nimblemachines.com/
+ *
+ * Copyright (c) 2002-2021 David Frech. (Read the LICENSE for details.)
+ */
+
+/*
+ * Packing target images for download. Serial links are slow, and images
+ * are full of runs of erased flash and repeated bits of threaded code, so
+ * it pays to send less and have the target unpack it.
+ *
+ * The format is a simple LZ77, chosen so the target's unpacker fits in a
+ * few dozen instructions. It is a series of tokens:
+ *
+ *   00 to 7f  - followed by token+1 bytes, to be copied as is;
+ *   80 to ff  - followed by one byte, d; copy token-80+3 bytes, starting
+ *               d+1 bytes back in what has been unpacked so far.
+ *
+ * A copy can overlap the bytes it is making: a run of one byte is a
+ * literal byte and then a copy from one back.
+ */
+
+#include "muforth.h"
+
+#define MAX_RUN     128     /* literal bytes per token */
+#define MIN_COPY    3
+#define MAX_COPY    (127 + MIN_COPY)
+#define WINDOW      256
+
+/* How many bytes, starting at from, match those at p? */
+static int match(uint8_t *from, uint8_t *p, uint8_t *end)
+{
+    int len = 0;
+
+    while (p + len < end && len < MAX_COPY && from[len] == p[len])
+        len++;
+    return len;
+}
+
+/* Write a literal run, if there is one. */
+static uint8_t *flush_run(uint8_t *out, uint8_t *run, uint8_t *p)
+{
+    while (run < p)
+    {
+        int len = p - run;
+
+        if (len > MAX_RUN) len = MAX_RUN;
+        *out++ = len - 1;
+        memcpy(out, run, len);
+        out += len;
+        run += len;
+    }
+    return out;
+}
+
+/*
+ * lz-pack  ( a u buf - u')
+ *
+ * Pack u bytes at a into buf, and return the packed length. buf must have
+ * room for u + u/128 + 1 bytes - what incompressible data takes.
+ */
+void mu_lz_pack()
+{
+    uint8_t *p = (uint8_t *)ST2;
+    uint8_t *end = p + ST1;
+    uint8_t *buf = (uint8_t *)TOP;
+    uint8_t *out = buf;
+    uint8_t *run = p;       /* start of bytes not yet written */
+
+    while (p < end)
+    {
+        uint8_t *from;
+        uint8_t *best = NULL;
+        int best_len = MIN_COPY - 1;
+
+        from = (p - (uint8_t *)ST2 > WINDOW) ? p - WINDOW : (uint8_t *)ST2;
+        for (; from < p; from++)
+        {
+            int len = match(from, p, end);
+
+            if (len > best_len)
+            {
+                best = from;
+                best_len = len;
+            }
+        }
+
+        if (best == NULL)
+        {
+            p++;
+            continue;
+        }
+        out = flush_run(out, run, p);
+        *out++ = 0x80 + best_len - MIN_COPY;
+        *out++ = p - best - 1;
+        p += best_len;
+        run = p;
+    }
+    out = flush_run(out, run, p);
+
+    ST2 = out - buf;
+    DROP(2);
+}
@@ -0,0 +1,80 @@
+/*
+ * This file is part of muforth: https://muforth.nimblemachines.com/
+ *
+ * Copyright (c) 2002-2021 David Frech. (Read the LICENSE for details.)
+ */
+
+/* Processes: just enough to run several builds at once. See build-all.mu4 */
+
+#include "muforth.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * A child forked from muforth gets a copy of everything: the dictionary,
+ * the stacks, and whatever the parent has loaded. Pages are shared until
+ * one side writes to them, so anything loaded before forking is loaded
+ * only once.
+ */
+
+/* fork  ( - pid) -- 0 in the child */
+void mu_fork()
+{
+    pid_t pid;
+
+    fflush(NULL);       /* don't let the child flush our buffers again */
+    pid = fork();
+    if (pid == -1)
+        return abort_strerror();
+    PUSH(pid);
+}
+
+/*
+ * wait-child  ( - pid status)
+ *
+ * Wait for any child to exit. A child killed by a signal has status 128
+ * plus the signal number, like the shell says.
+ */
+void mu_wait_child()
+{
+    pid_t pid;
+    int status;
+
+    while ((pid = wait(&status)) == -1)
+    {
+        if (errno == EINTR) continue;
+        return abort_strerror();
+    }
+    PUSH(pid);
+    if (WIFEXITED(status))
+        PUSH(WEXITSTATUS(status));
+    else
+        PUSH(128 + WTERMSIG(status));
+}
+
+/* dup2  ( fd fd2) -- make fd2 refer to the same file as fd */
+void mu_dup2()
+{
+    if (dup2(ST1, TOP) == -1)
+        return abort_strerror();
+    DROP(2);
+}
+
+/* #cpus  ( - n) */
+void mu_cpus_size()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    PUSH(n > 0 ? n : 1);
+}
+
+/* bye-status  ( status) -- like bye, but says how it went */
+void mu_bye_status()
+{
+    exit(TOP);
+}
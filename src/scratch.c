@@ -0,0 +1,61 @@
+/*
+ * This file is part of muforth: https://muforth.nimblemachines.com/
+ *
+ * Copyright (c) 2002-2021 David Frech. (Read the LICENSE for details.)
+ */
+
+/* scratch: space for transient strings, and a pad that stays put */
+
+#include "muforth.h"
+
+/*
+ * Strings that are only needed for a while - filenames passed to C,
+ * strings typed at the console - used to be copied into the dictionary
+ * and stayed there for good. Now they go into the scratch arena.
+ *
+ * The arena is allocated by bumping a pointer, which is an ordinary
+ * variable - scratch - so a word can say  scratch preserve  to give back
+ * everything allocated while it runs, even if it is unwound by an
+ * exception. ld and ld! do that around each file they load, and the
+ * console does it around each line it interprets. Nothing is ever reused
+ * while it is still live: when there isn't room left, scratch-allot
+ * aborts.
+ *
+ * pad used to be  here 128 +  and moved every time the dictionary grew.
+ * Now it has a home of its own. Numbers are converted into the 128 bytes
+ * below pad; the space above it is a buffer for the chat code.
+ */
+#define PAD_HOLD        128         /* 64 digits + sign + separators */
+#define PAD_DATA        8192        /* chat reads up to 4 KiB at a time */
+#define SCRATCH_SIZE    (64 * 1024)
+
+static cell pad_space[(PAD_HOLD + PAD_DATA) / sizeof(cell)];
+static cell arena[SCRATCH_SIZE / sizeof(cell)];
+static cell scratch = (addr)arena;      /* next free byte */
+
+void mu_pad()
+{
+    PUSH_ADDR((char *)pad_space + PAD_HOLD);
+}
+
+void mu_push_scratch()
+{
+    PUSH_ADDR(&scratch);
+}
+
+/* scratch-allot  ( u - a) */
+void mu_scratch_allot()
+{
+    char *p = (char *)scratch;
+    size_t n = ALIGNED(TOP);
+
+    if (n > SCRATCH_SIZE)
+        return abort_zmsg("too big for scratch");
+
+    if (p < (char *)arena || p > (char *)arena + SCRATCH_SIZE)
+        p = (char *)arena;
+    if (n > (size_t)((char *)arena + SCRATCH_SIZE - p))
+        return abort_zmsg("scratch full");
+    scratch = (addr)(p + n);
+    TOP = (addr)p;
+}
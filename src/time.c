@@ -54,6 +54,20 @@ void mu_push_clock()
     PUSH(time(NULL));       /* seconds since UNIX epoch */
 }
 
+/*
+ * nanoclock  ( - ns)
+ *
+ * For timing things: nanoseconds from some arbitrary starting point. The
+ * clock is monotonic, so setting the date doesn't disturb it.
+ */
+void mu_push_nanoclock()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    PUSH(ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
 /*
  * We need a way to do short sleeps for talking to sensitive hardware
  * targets (like the Freescale HC908 series). I'm not getting good data
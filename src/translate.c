@@ -0,0 +1,64 @@
+/*
+ * This file is part of muforth: https://muforth.nimblemachines.com/
+ *
+ * Copyright (c) 2002-2021 David Frech. (Read the LICENSE for details.)
+ */
+
+/*
+ * Translating text through a table, a buffer at a time. Escaping HTML or
+ * URIs a character at a time - a test and an emit for each - is slow, and
+ * most characters don't need escaping at all.
+ *
+ * The table has a cell for each of the 256 byte values. A zero means copy
+ * the byte as is; anything else is the address of a counted string (a
+ * z") to write in its place.
+ */
+
+#include "muforth.h"
+
+/*
+ * translate  ( a u table buf len - a' u' n)
+ *
+ * Translate as much of the u bytes at a as fits into the len bytes at buf.
+ * Return what is left of the source, and how many bytes went into buf.
+ * Runs of bytes that need no escaping are copied all at once. buf must
+ * have room for the longest replacement string, or we can't make
+ * progress.
+ */
+void mu_translate()
+{
+    uint8_t *p = (uint8_t *)SP[4];
+    uint8_t *end = p + ST3;
+    cell *table = (cell *)ST2;
+    uint8_t *buf = (uint8_t *)ST1;
+    uint8_t *out = buf;
+    uint8_t *limit = buf + TOP;
+
+    while (p < end)
+    {
+        uint8_t *run = p;
+        uint8_t *z;
+        cell len;
+
+        /* Find the next byte to replace. */
+        while (p < end && table[*p] == 0)
+            p++;
+        if (p - run > limit - out)
+            p = run + (limit - out);
+        memcpy(out, run, p - run);
+        out += p - run;
+        if (p == end || out == limit) break;
+
+        z = (uint8_t *)table[*p];
+        len = ((cell *)z)[-1];      /* count cell precedes the string */
+        if (len > limit - out) break;
+        memcpy(out, z, len);
+        out += len;
+        p++;
+    }
+
+    SP[4] = (cell)p;
+    ST3 = end - p;
+    ST2 = out - buf;
+    DROP(2);
+}
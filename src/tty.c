@@ -11,8 +11,12 @@
 #include "muforth.h"
 
 #include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/time.h>
 #include <termios.h>
 #include <unistd.h>         /* isatty */
+#include <time.h>
+#include <errno.h>
 
 /* stack: ( fd termios - sizeof(termios) ) */
 void mu_get_termios()
@@ -203,8 +207,141 @@ void mu_tty_drain()
     DROP(1);
 }
 
+/*
+ * Reading from a target a byte at a time costs a system call per byte, and
+ * with VTIME set, a byte that never comes costs two seconds. Instead, when
+ * we need a byte, we wait - with select, to the microsecond - for input,
+ * and then read whatever there is into a buffer for that fd, and take
+ * bytes from there until it is empty. close-file throws the buffer away,
+ * so that whatever opens the same fd next doesn't get stale bytes.
+ *
+ * rx-reads counts the reads, so that the chat statistics can count
+ * transfers rather than bytes.
+ */
+#define RX_FDS      8
+#define RX_BUFSIZE  4096
+
+struct rx
+{
+    int fd;                 /* fd + 1; 0 if unused */
+    size_t next;            /* next byte to take */
+    size_t count;           /* bytes in buf */
+    uint8_t buf[RX_BUFSIZE];
+};
+
+static struct rx rxs[RX_FDS];
+
+static cell recv_timeout = 2000000;     /* microseconds */
+static cell rx_reads;
+
+static struct rx *rx_for(int fd, int create)
+{
+    struct rx *prx;
+    struct rx *free = NULL;
+
+    for (prx = rxs; prx < rxs + RX_FDS; prx++)
+    {
+        if (prx->fd == fd + 1) return prx;
+        if (prx->fd == 0 && free == NULL) free = prx;
+    }
+    if (!create) return NULL;
+    if (free == NULL)
+    {
+        abort_zmsg("too many fds with receive buffers");
+        return NULL;
+    }
+    free->fd = fd + 1;
+    free->next = free->count = 0;
+    return free;
+}
+
+/* Forget any bytes buffered for fd; it is being closed. */
+void rx_forget(int fd)
+{
+    struct rx *prx = rx_for(fd, 0);
+
+    if (prx != NULL) prx->fd = 0;
+}
+
+static int64_t now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Wait until the deadline for input, and read what there is. */
+static int rx_fill(struct rx *prx, int fd, int64_t deadline)
+{
+    for (;;)
+    {
+        fd_set fds;
+        struct timeval tv;
+        ssize_t count;
+        int64_t left = deadline - now_us();
+
+        if (left <= 0) return 0;
+        tv.tv_sec = left / 1000000;
+        tv.tv_usec = left % 1000000;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        if (select(fd + 1, &fds, NULL, NULL, &tv) == -1)
+        {
+            if (errno == EINTR) continue;
+            abort_strerror();
+            return 0;
+        }
+        if (!FD_ISSET(fd, &fds)) continue;
+        while ((count = read(fd, prx->buf, RX_BUFSIZE)) == -1)
+        {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            abort_strerror();
+            return 0;
+        }
+        rx_reads++;
+        if (count > 0)
+        {
+            prx->next = 0;
+            prx->count = count;
+            return 1;
+        }
+    }
+}
+
+/* recv-timeout  ( - a) -- how long read-byte waits, in microseconds */
+void mu_recv_timeout()
+{
+    PUSH(&recv_timeout);
+}
+
+/* rx-reads  ( - a) -- how many times read-byte has read from a fd */
+void mu_rx_reads()
+{
+    PUSH(&rx_reads);
+}
+
+/* read-byte  ( fd - b -1 | 0) -- 0 if nothing came in time */
+void mu_read_byte()
+{
+    struct rx *prx = rx_for(TOP, 1);
+
+    if (prx == NULL) return;
+    if (prx->next == prx->count &&
+        !rx_fill(prx, TOP, now_us() + recv_timeout))
+    {
+        TOP = 0;
+        return;
+    }
+    TOP = prx->buf[prx->next++];
+    PUSH(-1);
+}
+
 void mu_tty_iflush()
 {
+    struct rx *prx = rx_for(TOP, 0);
+
+    if (prx != NULL) prx->next = prx->count = 0;
     tcflush(TOP, TCIFLUSH);     /* discard input */
     DROP(1);
 }
@@ -215,8 +352,13 @@ void mu_tty_iflush()
  */
 void mu_tty_icount()
 {
-    if (ioctl(TOP, FIONREAD, &TOP) == -1)
+    struct rx *prx = rx_for(TOP, 0);
+    int count;
+
+    if (ioctl(TOP, FIONREAD, &count) == -1)
         return abort_strerror();
+    if (prx != NULL) count += prx->count - prx->next;
+    TOP = count;
 }
 
 /*
@@ -16,6 +16,14 @@
 #include <fcntl.h>          /* open */
 #include <unistd.h>         /* close */
 #include <sys/ioctl.h>      /* ioctl */
+#include <sys/stat.h>       /* stat */
+#include <sys/sysmacros.h>  /* major, minor */
+#include <sys/select.h>     /* select */
+#include <sys/inotify.h>    /* inotify */
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>          /* snprintf */
+#include <time.h>           /* clock_gettime */
 
 /* Normal USB devices */
 #include <linux/usb/ch9.h>
@@ -25,9 +33,6 @@
 #include <linux/hidraw.h>
 #include <linux/input.h>
 
-#ifdef DEBUG_USB_ENUMERATION
-#include <stdio.h>
-#endif
 
 /*
  * The two places USB devices can live. /dev/bus/usb is the "newer" place,
@@ -41,8 +46,46 @@
 
 #define USB_PATH_MAX (strlen(USB_ROOT2)+16)
 
-typedef int (*usb_match_fn)(char *, int vid, int pid);    /* filepath, vendor id, product id */
-typedef int (*path_ok_fn)(struct dirent *);
+/*
+ * Opening every device and reading its descriptor, every time we look for
+ * one, is slow when there are dozens of them. So we do it once, and keep
+ * what we learned - each device's path, vendor and product ids, and
+ * serial number - in a cache.
+ *
+ * inotify keeps the cache current. We watch /dev/bus/usb, each bus
+ * directory in it, and /dev - for hidraw devices. When a device node
+ * appears, or its permissions change - udev makes the node first, and
+ * then lets us at it - we look at just that device; when one goes away we
+ * forget it. If we can't watch - on /proc/bus/usb, say - we enumerate
+ * everything each time, as we always did.
+ */
+#define CACHE_MAX   128
+#define SERIAL_MAX  64
+#define WATCH_MAX   64
+
+struct cached_dev
+{
+    char path[32];
+    int vid;
+    int pid;
+    int hid;                    /* a hidraw device, not a usbfs one */
+    char serial[SERIAL_MAX];
+};
+
+static struct cached_dev cache[CACHE_MAX];
+static int cached;              /* entries in use */
+static int cache_ok;            /* populated, and inotify is watching */
+
+static int inotify_fd = -1;
+
+static struct watch
+{
+    int wd;
+    char path[32];
+} watches[WATCH_MAX];
+static int nwatches;
+
+static char serial_wanted[SERIAL_MAX];  /* empty matches any */
 
 /*
  * Check if a directory exists and is readable.
@@ -65,109 +108,252 @@ static int dir_exists(char *path)
     return(-1);
 }
 
-/*
- * Returns
- *  <0 if error
- *   0 if directory exhausted
- *  >0 if match found
- */
-static int foreach_dirent(char *path, path_ok_fn try_path,
-                          usb_match_fn fn, int vid, int pid)
+static int is_bus_or_dev(char *name)
 {
-    char pathbuf[USB_PATH_MAX];
-    DIR *pdir;
-    struct dirent *pde;
-
-    pdir = opendir(path);
-
-    /* Return error if directory couldn't be opened. */
-    if (pdir == NULL) return -1;
+    /* bus and device entry names are 3 decimal digits */
+    return isdigit(name[0]);
+}
 
-    while ((pde = readdir(pdir)) != NULL)
-    {
-        /* make sure this is a dirent we care about */
-        if (try_path(pde))
-        {
-            int matched;
-
-            concat_paths(pathbuf, USB_PATH_MAX, path, pde->d_name);
-            matched = fn(pathbuf, vid, pid);
-
-            /*
-             * matched < 0 means matched but error opening read/write
-             *        == 0 means no match
-             *         > 0 means match and device opened read/write
-             *
-             * We want to keep looking if no match, but exit otherwise.
-             */
-            if (matched != 0)
-            {
-               closedir(pdir);
-               return matched;   /* open fd of matched device or error */
-            }
-        }
-    }
-    closedir(pdir);
-    return 0;   /* no match */
+static int is_hidraw(char *name)
+{
+    return strncmp(name, "hidraw", 6) == 0;
 }
 
 /*
- * match_device returns 0 if there was no match (or if it couldn't open a
- * device); >0 if it successfully matched the device and was able to open
- * it read/write; <0 if it matched a device but couldn't open it (the only
- * true error condition we care about).
+ * The serial number is in sysfs, so we don't have to ask the device. A
+ * usbfs node's sysfs directory is the USB device's; a hidraw node's is
+ * three levels down from it: interface, HID device, hidraw.
  */
-static int match_device(char *dev, int vid, int pid)
+static void read_serial(char *dev, int hid, char *serial)
 {
+    struct stat st;
+    char sys[80];
     int fd;
-    struct usb_device_descriptor dev_desc;
-    int count;
+    ssize_t count;
+
+    serial[0] = '\0';
+    if (stat(dev, &st) == -1) return;
+    snprintf(sys, sizeof(sys), "/sys/dev/char/%u:%u/%sserial",
+             major(st.st_rdev), minor(st.st_rdev),
+             hid ? "device/../../" : "");
+    fd = open(sys, O_RDONLY);
+    if (fd == -1) return;
+    count = read(fd, serial, SERIAL_MAX - 1);
+    close(fd);
+    if (count < 0) count = 0;
+    while (count > 0 && (serial[count-1] == '\n' || serial[count-1] == '\0'))
+        count--;
+    serial[count] = '\0';
+}
+
+/* Read a device's ids. Returns 0 if we couldn't. */
+static int probe(char *dev, int hid, int *vid, int *pid)
+{
+    int fd;
+    int ok = 0;
 
 #ifdef DEBUG_USB_ENUMERATION
-    fprintf(stderr, "match_device: trying %s\n", dev);
+    fprintf(stderr, "probe: trying %s\n", dev);
 #endif
     fd = open(dev, O_RDONLY);
     if (fd == -1) return 0;
 
-    count = read(fd, &dev_desc, USB_DT_DEVICE_SIZE);
-    if (count != USB_DT_DEVICE_SIZE) return 0;
-    /* was assert(count == USB_DT_DEVICE_SIZE, "couldn't read device descriptor"); */
+    if (hid)
+    {
+        struct hidraw_devinfo info;
+
+        /* Linux idiots! They defined these as _signed_ 16-bit ints. */
+        if (ioctl(fd, HIDIOCGRAWINFO, &info) != -1 && info.bustype == BUS_USB)
+        {
+            *vid = (uint16_t)info.vendor;
+            *pid = (uint16_t)info.product;
+            ok = 1;
+        }
+    }
+    else
+    {
+        struct usb_device_descriptor dev_desc;
 
+        if (read(fd, &dev_desc, USB_DT_DEVICE_SIZE) == USB_DT_DEVICE_SIZE)
+        {
+            *vid = __le16_to_cpu(dev_desc.idVendor);
+            *pid = __le16_to_cpu(dev_desc.idProduct);
+            ok = 1;
+        }
+    }
     close(fd);
+    return ok;
+}
 
-    if (__le16_to_cpu(dev_desc.idVendor) == vid &&
-        __le16_to_cpu(dev_desc.idProduct) == pid)
-        return open(dev, O_RDWR);   /* Re-open read-write; this could fail! */
+static void forget(char *dev)
+{
+    int i;
 
-    return 0;
+    for (i = 0; i < cached; i++)
+        if (strcmp(cache[i].path, dev) == 0)
+        {
+            cache[i] = cache[--cached];
+            return;
+        }
 }
 
-static int is_bus_or_dev(struct dirent *pde)
+static void learn(char *dev, int hid)
 {
-    /* bus and device entry names are 3 decimal digits */
-    return isdigit(pde->d_name[0]) ? -1 : 0;
+    struct cached_dev *pcd;
+
+    forget(dev);
+    if (cached == CACHE_MAX) return;
+    pcd = &cache[cached];
+    if (!probe(dev, hid, &pcd->vid, &pcd->pid)) return;
+    strncpy(pcd->path, dev, sizeof(pcd->path) - 1);
+    pcd->path[sizeof(pcd->path) - 1] = '\0';
+    pcd->hid = hid;
+    read_serial(dev, hid, pcd->serial);
+    cached++;
+}
+
+static void watch(char *dir)
+{
+    int wd;
+
+    if (inotify_fd == -1 || nwatches == WATCH_MAX) return;
+    wd = inotify_add_watch(inotify_fd, dir,
+            IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM);
+    if (wd == -1) return;
+    watches[nwatches].wd = wd;
+    strncpy(watches[nwatches].path, dir, sizeof(watches[0].path) - 1);
+    nwatches++;
+}
+
+/* Learn every device in dir whose name passes ok; and watch dir. */
+static void learn_dir(char *dir, int (*ok)(char *), int hid)
+{
+    char pathbuf[USB_PATH_MAX];
+    DIR *pdir;
+    struct dirent *pde;
+
+    watch(dir);
+    pdir = opendir(dir);
+    if (pdir == NULL) return;
+    while ((pde = readdir(pdir)) != NULL)
+    {
+        if (!ok(pde->d_name)) continue;
+        concat_paths(pathbuf, USB_PATH_MAX, dir, pde->d_name);
+        learn(pathbuf, hid);
+    }
+    closedir(pdir);
 }
 
-static int enumerate_devices(char *bus, int vid, int pid)
+static void learn_bus(char *bus)
 {
-    return foreach_dirent(bus, is_bus_or_dev, match_device, vid, pid);
+    learn_dir(bus, is_bus_or_dev, 0);
+}
+
+static void populate()
+{
+    char pathbuf[USB_PATH_MAX];
+    int newer = dir_exists(USB_ROOT1);
+    char *root = newer ? USB_ROOT1 : USB_ROOT2;
+    DIR *pdir;
+    struct dirent *pde;
+
+    /* We only search one or the other; and we can't watch /proc. */
+    if (inotify_fd != -1) close(inotify_fd);
+    inotify_fd = newer ? inotify_init1(IN_NONBLOCK | IN_CLOEXEC) : -1;
+    nwatches = 0;
+    cached = 0;
+
+    watch(root);
+    pdir = opendir(root);
+    if (pdir != NULL)
+    {
+        while ((pde = readdir(pdir)) != NULL)
+        {
+            if (!is_bus_or_dev(pde->d_name)) continue;
+            concat_paths(pathbuf, USB_PATH_MAX, root, pde->d_name);
+            learn_bus(pathbuf);
+        }
+        closedir(pdir);
+    }
+    learn_dir("/dev", is_hidraw, 1);
+
+    cache_ok = (inotify_fd != -1);
+}
+
+/* Bring the cache up to date with whatever inotify has told us. */
+static void refresh()
+{
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    if (!cache_ok) return populate();
+
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0)
+    {
+        char *p;
+
+        for (p = buf; p < buf + len;
+             p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+        {
+            struct inotify_event *pev = (struct inotify_event *)p;
+            char pathbuf[USB_PATH_MAX];
+            char *dir = NULL;
+            int i, hid;
+
+            if (pev->mask & IN_Q_OVERFLOW)
+            {
+                cache_ok = 0;
+                return populate();
+            }
+            for (i = 0; i < nwatches; i++)
+                if (watches[i].wd == pev->wd) dir = watches[i].path;
+            if (dir == NULL || pev->len == 0) continue;
+
+            hid = (strcmp(dir, "/dev") == 0);
+            if (hid ? !is_hidraw(pev->name) : !is_bus_or_dev(pev->name))
+                continue;
+            concat_paths(pathbuf, USB_PATH_MAX, dir, pev->name);
+
+            if (pev->mask & (IN_DELETE | IN_MOVED_FROM))
+                forget(pathbuf);
+            else if (pev->mask & IN_ISDIR)
+                learn_bus(pathbuf);     /* a new bus */
+            else
+                learn(pathbuf, hid);
+        }
+    }
 }
 
 /*
- * usb-find-device (vendor-id product-id -- dev -1 | 0)
+ * Look in the cache for a device, and open it read/write. Returns 0 if
+ * there was no match; >0 - the open fd - if we matched and opened it; <0
+ * if we matched a device but couldn't open it (the only true error
+ * condition we care about). A device that has gone away without our
+ * noticing doesn't count as a match.
  */
-void mu_usb_find_device()
+static int find_device(int vid, int pid, int hid)
 {
-    int matched;
-    int vid = ST1;
-    int pid = TOP;
+    int i;
 
-    /* Enumerate USB device tree, looking for a match */
-    if (dir_exists(USB_ROOT1))
-        matched = foreach_dirent(USB_ROOT1, is_bus_or_dev, enumerate_devices, vid, pid);
-    else
-        matched = foreach_dirent(USB_ROOT2, is_bus_or_dev, enumerate_devices, vid, pid);
+    refresh();
+    for (i = 0; i < cached; i++)
+    {
+        struct cached_dev *pcd = &cache[i];
+        int fd;
+
+        if (pcd->vid != vid || pcd->pid != pid || pcd->hid != hid) continue;
+        if (serial_wanted[0] && strcmp(pcd->serial, serial_wanted) != 0)
+            continue;
+        fd = open(pcd->path, O_RDWR);   /* this could fail! */
+        if (fd != -1) return fd;
+        if (errno != ENOENT) return -1;
+    }
+    return 0;
+}
 
+/* Push the result of find_device: dev -1 | 0 */
+static void push_found(int matched)
+{
     if (matched < 0) return abort_strerror();
 
     if (matched == 0)
@@ -186,6 +372,100 @@ void mu_usb_find_device()
     }
 }
 
+/*
+ * usb-find-device (vendor-id product-id -- dev -1 | 0)
+ */
+void mu_usb_find_device()
+{
+    push_found(find_device(ST1, TOP, 0));
+}
+
+/*
+ * usb-serial  ( z" | 0)
+ *
+ * From now on, find and wait for only devices with this serial number; or,
+ * given 0, any serial number.
+ */
+void mu_usb_serial()
+{
+    serial_wanted[0] = '\0';
+    if (TOP)
+        strncat(serial_wanted, (char *)TOP, SERIAL_MAX - 1);
+    DROP(1);
+}
+
+/*
+ * Wait as long as ms milliseconds for a matching device to appear. While
+ * inotify is watching, we sleep until it tells us something has changed;
+ * otherwise we look again every 100 ms.
+ *
+ * A device that has just appeared often can't be opened until udev has
+ * set its permissions, so being refused is "not yet" too; we look again
+ * every 100 ms, and report the error only if we are still refused when
+ * time runs out.
+ */
+static void wait_device(int hid)
+{
+    struct timespec now, deadline;
+    int vid = ST2;
+    int pid = ST1;
+    int matched;
+    int refused;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += TOP / 1000;
+    deadline.tv_nsec += (TOP % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    DROP(1);
+
+    while ((matched = find_device(vid, pid, hid)) <= 0)
+    {
+        struct timeval tv;
+        fd_set fds;
+        long left;
+
+        refused = (matched < 0) ? errno : 0;
+        if (refused && refused != EACCES && refused != EPERM) break;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left = (deadline.tv_sec - now.tv_sec) * 1000000
+             + (deadline.tv_nsec - now.tv_nsec) / 1000;
+        if (left <= 0)
+        {
+            errno = refused;
+            break;
+        }
+        if ((!cache_ok || refused) && left > 100000) left = 100000;
+        tv.tv_sec = left / 1000000;
+        tv.tv_usec = left % 1000000;
+        FD_ZERO(&fds);
+        if (cache_ok) FD_SET(inotify_fd, &fds);
+        if (select(cache_ok ? inotify_fd + 1 : 0, &fds, NULL, NULL, &tv) == -1
+            && errno != EINTR)
+            return abort_strerror();
+    }
+    push_found(matched);
+}
+
+/*
+ * usb-wait-device  ( vendor-id product-id ms -- dev -1 | 0)
+ */
+void mu_usb_wait_device()
+{
+    wait_device(0);
+}
+
+/*
+ * hid-wait-device  ( vendor-id product-id ms -- dev -1 | 0)
+ */
+void mu_hid_wait_device()
+{
+    wait_device(1);
+}
+
 /*
  * usb-claim-interface  ( interface dev)
  */
@@ -316,75 +596,12 @@ void mu_usb_write()
  * arguments permuted.
  */
 
-/*
- * match_hid returns 0 if there was no match (or if it couldn't open a
- * device); >0 if it successfully matched the device and was able to open
- * it read/write; <0 if it matched a device but couldn't open it (the only
- * true error condition we care about).
- */
-static int match_hid(char *dev, int vid, int pid)
-{
-    int fd;
-    struct hidraw_devinfo hid;
-
-#ifdef DEBUG_USB_ENUMERATION
-    fprintf(stderr, "match_hid: trying %s\n", dev);
-#endif
-    fd = open(dev, O_RDONLY);
-    if (fd == -1) return 0;
-
-    if (ioctl(fd, HIDIOCGRAWINFO, &hid) == -1)
-        return 0;
-
-    close(fd);
-
-    /* XXX have vendor and product fields been rewritten from USB
-     * endianness (little) to local host's? */
-
-    /* Linux idiots! They defined these as _signed_ 16-bit ints. */
-    if (hid.bustype == BUS_USB &&
-        (unsigned)hid.vendor == vid && (unsigned)hid.product == pid)
-        return open(dev, O_RDWR);   /* Re-open read-write; could fail! */
-
-    return 0;
-}
-
 /*
  * hid-find-device (vendor-id product-id -- dev -1 | 0)
  */
 void mu_hid_find_device()
 {
-    int matched;
-    int devnum;
-    char dev_hidraw[] = "/dev/hidrawX";
-    int vid = ST1;
-    int pid = TOP;
-
-    /* Try hidraw0 to hidraw9 */
-    for (devnum = '0'; devnum <= '9'; devnum++)
-    {
-        dev_hidraw[11] = devnum;
-        matched = match_hid(dev_hidraw, vid, pid);
-        if (matched != 0) break;
-    }
-
-    if (matched < 0) return abort_strerror();
-
-    if (matched == 0)
-    {
-        /* No match found */
-        DROP(1);
-        TOP = 0;
-    }
-    else
-    {
-        /*
-         * Found a match; matched has the device's _open_ file descriptor.
-         * Return it.
-         */
-        ST1 = matched;
-        TOP = -1;
-    }
+    push_found(find_device(ST1, TOP, 1));
 }
 
 /*
@@ -0,0 +1,316 @@
+/*
+ * This file is part of muforth: https://muforth.nimblemachines.com/
+ *
+ * Copyright (c) 2002-2021 David Frech. (Read the LICENSE for details.)
+ */
+
+/*
+ * UTF-8, a buffer at a time. lib/utf8.mu4 has words to read and write one
+ * character; these are for whole strings - validating them, counting
+ * their characters and screen columns, and converting to and from arrays
+ * of code points.
+ *
+ * Code point arrays are UTF-32LE: four bytes per code point, little end
+ * first, whatever the host's byte order. lew@ and lew! read and write
+ * them.
+ *
+ * Most text is ASCII, so each loop looks at eight bytes at a time and
+ * skips them in one go if none has its top bit set. This is the same test
+ * a SIMD unit would do sixteen or thirty-two bytes at a time, but in plain
+ * C it works on every host we run on.
+ */
+
+#include "muforth.h"
+
+#define HIGH_BITS   0x8080808080808080ULL
+#define ONES        0x0101010101010101ULL
+
+#define REPLACEMENT 0xfffd
+
+static uint64_t load8(uint8_t *p)
+{
+    uint64_t w;
+
+    memcpy(&w, p, 8);
+    return w;
+}
+
+static void store_le32(uint8_t *p, uint32_t w)
+{
+    p[0] = w;
+    p[1] = w >> 8;
+    p[2] = w >> 16;
+    p[3] = w >> 24;
+}
+
+static uint32_t fetch_le32(uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * Decode the character at p, checking it properly: no overlong forms, no
+ * surrogates, nothing past 10ffff. Return its length, or 0 if it is
+ * malformed or runs past end.
+ */
+static int decode(uint8_t *p, uint8_t *end, uint32_t *cp)
+{
+    uint32_t c = p[0];
+    uint8_t lo = 0x80, hi = 0xbf;   /* range of the second byte */
+    int len, i;
+
+    if (c < 0x80) { *cp = c; return 1; }
+
+    if (c < 0xc2) return 0;
+    else if (c < 0xe0) { len = 2; c &= 0x1f; }
+    else if (c < 0xf0)
+    {
+        len = 3; c &= 0x0f;
+        if (p[0] == 0xe0) lo = 0xa0;        /* overlong */
+        if (p[0] == 0xed) hi = 0x9f;        /* surrogates */
+    }
+    else if (c < 0xf5)
+    {
+        len = 4; c &= 0x07;
+        if (p[0] == 0xf0) lo = 0x90;        /* overlong */
+        if (p[0] == 0xf4) hi = 0x8f;        /* past 10ffff */
+    }
+    else return 0;
+
+    if (end - p < len) return 0;
+    if (p[1] < lo || p[1] > hi) return 0;
+    for (i = 1; i < len; i++)
+    {
+        if ((p[i] & 0xc0) != 0x80) return 0;
+        c = (c << 6) | (p[i] & 0x3f);
+    }
+    *cp = c;
+    return len;
+}
+
+/*
+ * How many columns does c take on a terminal? This is a short version of
+ * wcwidth(3): combining marks and zero-width spaces take none; the East
+ * Asian wide and fullwidth blocks, and emoji, take two.
+ */
+struct range { uint32_t first, last; };
+
+static struct range zero_width[] = {
+    { 0x0300, 0x036f }, { 0x0483, 0x0489 }, { 0x0591, 0x05bd },
+    { 0x0610, 0x061a }, { 0x064b, 0x065f }, { 0x0e31, 0x0e31 },
+    { 0x0e34, 0x0e3a }, { 0x1ab0, 0x1aff }, { 0x1dc0, 0x1dff },
+    { 0x200b, 0x200f }, { 0x20d0, 0x20ff }, { 0xfe00, 0xfe0f },
+    { 0xfe20, 0xfe2f }, { 0xe0100, 0xe01ef },
+};
+
+static struct range wide[] = {
+    { 0x1100, 0x115f }, { 0x2e80, 0x303e }, { 0x3041, 0x33ff },
+    { 0x3400, 0x4dbf }, { 0x4e00, 0x9fff }, { 0xa000, 0xa4cf },
+    { 0xac00, 0xd7a3 }, { 0xf900, 0xfaff }, { 0xfe30, 0xfe4f },
+    { 0xff00, 0xff60 }, { 0xffe0, 0xffe6 }, { 0x1f300, 0x1f64f },
+    { 0x1f900, 0x1f9ff }, { 0x20000, 0x2fffd }, { 0x30000, 0x3fffd },
+};
+
+static int in_ranges(uint32_t c, struct range *r, int n)
+{
+    int lo = 0, hi = n - 1;
+
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        if (c < r[mid].first) hi = mid - 1;
+        else if (c > r[mid].last) lo = mid + 1;
+        else return 1;
+    }
+    return 0;
+}
+
+static int columns(uint32_t c)
+{
+    if (c < 0x20 || (c >= 0x7f && c < 0xa0)) return 0;
+    if (c < 0x300) return 1;
+    if (in_ranges(c, zero_width, sizeof(zero_width) / sizeof(struct range)))
+        return 0;
+    if (in_ranges(c, wide, sizeof(wide) / sizeof(struct range)))
+        return 2;
+    return 1;
+}
+
+/*
+ * utf8-check  ( a u - u')
+ *
+ * How many bytes at the start of the string are well-formed UTF-8? u' = u
+ * if they all are.
+ */
+void mu_utf8_check()
+{
+    uint8_t *start = (uint8_t *)ST1;
+    uint8_t *p = start;
+    uint8_t *end = p + TOP;
+    uint32_t c;
+
+    while (p < end)
+    {
+        int len;
+
+        if (end - p >= 8 && (load8(p) & HIGH_BITS) == 0)
+        {
+            p += 8;
+            continue;
+        }
+        len = decode(p, end, &c);
+        if (len == 0) break;
+        p += len;
+    }
+    ST1 = p - start;
+    DROP(1);
+}
+
+/*
+ * utf8-count  ( a u - n)
+ *
+ * How many characters are in the string? We count the bytes that are not
+ * continuation bytes - 10xx_xxxx - so the string should be well-formed.
+ */
+void mu_utf8_count()
+{
+    uint8_t *p = (uint8_t *)ST1;
+    uint8_t *end = p + TOP;
+    cell n = 0;
+
+    for (; end - p >= 8; p += 8)
+    {
+        uint64_t w = load8(p);
+        uint64_t cont = w & ~(w << 1) & HIGH_BITS;     /* 10xx_xxxx */
+
+        n += 8 - (int)(((cont >> 7) * ONES) >> 56);
+    }
+    for (; p < end; p++)
+        n += (*p & 0xc0) != 0x80;
+    ST1 = n;
+    DROP(1);
+}
+
+/*
+ * utf8-columns  ( a u - n)
+ *
+ * How many columns does the string take on a terminal? Malformed bytes
+ * are shown as a replacement character, taking a column each.
+ */
+void mu_utf8_columns()
+{
+    uint8_t *p = (uint8_t *)ST1;
+    uint8_t *end = p + TOP;
+    uint32_t c;
+    cell n = 0;
+
+    while (p < end)
+    {
+        int len;
+
+        if (end - p >= 8)
+        {
+            uint64_t w = load8(p);
+
+            /* Eight printable ASCII characters? No top bits set, none
+             * less than 20, and none equal to 7f. */
+            if (((w | ((w - 0x20 * ONES) & ~w)
+                    | ((w ^ 0x7f * ONES) - ONES)) & HIGH_BITS) == 0)
+            {
+                n += 8;
+                p += 8;
+                continue;
+            }
+        }
+        len = decode(p, end, &c);
+        if (len == 0) { len = 1; c = REPLACEMENT; }
+        n += columns(c);
+        p += len;
+    }
+    ST1 = n;
+    DROP(1);
+}
+
+/*
+ * utf8>utf32  ( a u buf - n)
+ *
+ * Convert the string to code points in buf, and return how many there are.
+ * Each malformed byte becomes a U+FFFD. buf must have room for 4u bytes.
+ */
+void mu_utf8_to_utf32()
+{
+    uint8_t *p = (uint8_t *)ST2;
+    uint8_t *end = p + ST1;
+    uint8_t *out = (uint8_t *)TOP;
+    uint8_t *buf = out;
+    uint32_t c;
+
+    while (p < end)
+    {
+        int len;
+
+        if (end - p >= 8 && (load8(p) & HIGH_BITS) == 0)
+        {
+            int i;
+
+            for (i = 0; i < 8; i++, out += 4)
+                store_le32(out, p[i]);
+            p += 8;
+            continue;
+        }
+        len = decode(p, end, &c);
+        if (len == 0) { len = 1; c = REPLACEMENT; }
+        store_le32(out, c);
+        out += 4;
+        p += len;
+    }
+    ST2 = (out - buf) / 4;
+    DROP(2);
+}
+
+/*
+ * utf32>utf8  ( buf n a - u)
+ *
+ * Convert n code points in buf to UTF-8 at a, and return its length.
+ * Surrogates and anything past 10ffff become U+FFFD. a must have room for
+ * 4n bytes.
+ */
+void mu_utf32_to_utf8()
+{
+    uint8_t *p = (uint8_t *)ST2;
+    uint8_t *end = p + ST1 * 4;
+    uint8_t *out = (uint8_t *)TOP;
+    uint8_t *start = out;
+
+    for (; p < end; p += 4)
+    {
+        uint32_t c = fetch_le32(p);
+
+        if (c < 0x80)
+        {
+            *out++ = c;
+            continue;
+        }
+        if ((c >= 0xd800 && c < 0xe000) || c > 0x10ffff)
+            c = REPLACEMENT;
+        if (c < 0x800)
+        {
+            *out++ = 0xc0 | (c >> 6);
+        }
+        else if (c < 0x10000)
+        {
+            *out++ = 0xe0 | (c >> 12);
+            *out++ = 0x80 | ((c >> 6) & 0x3f);
+        }
+        else
+        {
+            *out++ = 0xf0 | (c >> 18);
+            *out++ = 0x80 | ((c >> 12) & 0x3f);
+            *out++ = 0x80 | ((c >> 6) & 0x3f);
+        }
+        *out++ = 0x80 | (c & 0x3f);
+    }
+    ST2 = out - start;
+    DROP(2);
+}